@@ -3,8 +3,15 @@
 import select
 import os
 import fcntl
+import termios
 import struct
+import array
+import errno
+import collections
+import glob
+import io
 import exceptions
+import ctypes
 from time import sleep
 
 
@@ -18,149 +25,365 @@ from time import sleep
 input_event_struct = "@llHHi"
 input_event_size = struct.calcsize(input_event_struct)
 
+def EVIOCGNAME(length):
+    return (2 << 30) | (length << 16) | (ord('E') << 8) | 0x06
+
 EVENT_BUTTON_PRESS = 1
 EVENT_RELATIVE_MOTION = 2
 RELATIVE_AXES_DIAL = 7
 BUTTON_MISC = 0x100
 
+# Linux serial driver ioctls, struct serial_struct has flags at offset 16
+TIOCGSERIAL = 0x541E
+TIOCSSERIAL = 0x541F
+SERIAL_STRUCT_SIZE = 128
+SERIAL_FLAGS_OFFSET = 16
+ASYNC_LOW_LATENCY = 1 << 13
+
+# Serial frames are parsed by parseDialFrame from firmware/dialproto.h,
+# the firmware's own parser, built into a shared library by
+# "make -C firmware/host".  Without the library, dialbox falls back to
+# the same state machine in Python.
+DIALPROTO_LIB = os.environ.get('DIALPROTO_LIB',
+                               os.path.join(os.path.dirname(os.path.abspath(__file__)),
+                                            'firmware', 'host', 'libdialproto.so'))
+
+def LoadDialProto():
+    try:
+        lib = ctypes.CDLL(DIALPROTO_LIB)
+    except exceptions.OSError:
+        return None
+    lib.dialproto_parser_size.restype = ctypes.c_size_t
+    lib.dialproto_parse.restype = ctypes.c_int
+    lib.dialproto_parse.argtypes = [ctypes.c_void_p, ctypes.c_char_p, ctypes.c_int,
+                                    ctypes.POINTER(ctypes.c_uint8),
+                                    ctypes.POINTER(ctypes.c_uint16), ctypes.c_int,
+                                    ctypes.POINTER(ctypes.c_uint)]
+    return lib
+
 
 # these are to select the appropriate kind of dialbox you use
 SGI = 1
 SPECTRAGRAPHICS = 2
 
+# A dial box on a serial port, read directly without the converter.
+# waitevent returns (dial, position) tuples to Python callers.  To feed
+# such a box into the MIDI relays instead, pass its port to
+# server/dialbox.js, see server/serialbox.js.  The parts that set the latency are system calls
+# (raw termios, the low latency flag, bulk reads after epoll) and the
+# frame parser is the firmware's, via libdialproto where it has been
+# built, so a separate native backend would not be faster.
 class dialbox:
     def __init__(self, dev=None, timeout=1000, model=SGI):
-        try:
-            import serial
-        except:
-            print 'eventio-error: dialbox driver needs the serial module (http://pyserial.sf.net)'
+        self.fd = -1
+        self.resyncs = 0 # bytes skipped to find the next frame
+        self.event_queue = collections.deque()
 
         if dev is None:
             return None
 
         try:
-		DEV = '/dev/ttyS%d' % int(dev)
+            DEV = '/dev/ttyS%d' % int(dev)
         except:
-		DEV = str(dev)
+            DEV = str(dev)
 
         # dialbox commands 
         self.DIAL_INITIALIZE  = "%c%c%c%c" % (0x20, 0x50, 0x00, 0xFF)
         self.DIAL_BASE         = 0x30
         self.DIAL_DELTA_BASE   = 0x40
 
-        try:
-            self.serial = serial.Serial(DEV,9600, timeout=timeout/1000)
-        except serial.SerialException:
-            print 'eventio-error: Unable to find dialbox. Is it connected? To the right port?'
-            return None
-
         if model == SGI or model == SPECTRAGRAPHICS:
             self.model = model
         else:
             print 'eventio-error: dialbox model not recognized'
             return None
 
+        self.dialproto = LoadDialProto()
+        if self.dialproto:
+            self.parser = ctypes.create_string_buffer(self.dialproto.dialproto_parser_size())
+        else:
+            print 'eventio-info: dialbox: %s not built, parsing frames in Python' % DIALPROTO_LIB
+        self.frame_count = 0 # parser state without libdialproto
+
+        try:
+            self.fd = os.open(DEV, os.O_RDWR | os.O_NOCTTY | os.O_NONBLOCK)
+        except exceptions.OSError:
+            print 'eventio-error: Unable to find dialbox. Is it connected? To the right port?'
+            return None
+
+        self.timeout = timeout
+        self.SetRaw()
+        self.SetLowLatency()
+
+        if hasattr(select, 'epoll'):
+            self.poll = select.epoll()
+            self.poll.register(self.fd, select.EPOLLIN)
+        else:
+            self.poll = select.poll()
+            self.poll.register(self.fd, select.POLLIN)
+
+
         # self.dial used by SGI to turn absolute into relative events
         self.dial = [0,0,0,0, 0,0,0,0]
-        self.serial.flushInput()
-        self.serial.flushOutput()
-        self.serial.write(self.DIAL_INITIALIZE)
+        termios.tcflush(self.fd, termios.TCIOFLUSH)
+        os.write(self.fd, self.DIAL_INITIALIZE)
         sleep(timeout/1000) # check if can do without
         self.read_bytes()
         print "eventio-info: dialbox: initialized."
 
     def __del__(self):
-        self.serial.close()
+        if self.fd >= 0:
+            os.close(self.fd)
+            self.fd = -1
 
-    # read and print whatever is left on the serial line
+    # 9600 baud, 8N1, no line discipline processing, non-blocking reads
+    def SetRaw(self):
+        attrs = termios.tcgetattr(self.fd)
+        attrs[0] = 0 # iflag
+        attrs[1] = 0 # oflag
+        attrs[2] = termios.CS8 | termios.CREAD | termios.CLOCAL
+        attrs[3] = 0 # lflag
+        attrs[4] = attrs[5] = termios.B9600
+        attrs[6][termios.VMIN] = 0
+        attrs[6][termios.VTIME] = 0
+        termios.tcsetattr(self.fd, termios.TCSANOW, attrs)
+
+    # ask the UART driver to push received bytes to the tty layer right
+    # away instead of batching them on a timer
+    def SetLowLatency(self):
+        serial_struct = array.array('B', [0] * SERIAL_STRUCT_SIZE)
+        try:
+            fcntl.ioctl(self.fd, TIOCGSERIAL, serial_struct, True)
+            (flags,) = struct.unpack_from('@i', serial_struct, SERIAL_FLAGS_OFFSET)
+            struct.pack_into('@i', serial_struct, SERIAL_FLAGS_OFFSET, flags | ASYNC_LOW_LATENCY)
+            fcntl.ioctl(self.fd, TIOCSSERIAL, serial_struct)
+        except (exceptions.IOError, AttributeError):
+            pass # not a Linux serial_core port, e.g. a USB adapter
+
+    # read and discard whatever is left on the serial line
     def read_bytes(self):
-        n=self.serial.inWaiting()
-        if n == 0:
-            return None
-        format = '@%dB' % n
-        data = self.serial.read(n)
-        #print struct.unpack(format,data[:n])
+        while self.ReadAvailable():
+            pass
+        if self.dialproto:
+            ctypes.memset(self.parser, 0, len(self.parser))
+        self.frame_count = 0
 
-    def waitevent(self):
-        data = self.serial.read(3)
-        if len(data) != 3 : return None
-        (b1,b2,b3)=struct.unpack('@BBB',data)
-        (val,)  =struct.unpack('>H',data[1:3])
-        dial = b1 - self.DIAL_BASE
-        
-        if dial < 0 or dial > 7:
+    # read everything the driver has buffered, returns '' if nothing
+    def ReadAvailable(self):
+        data = ''
+        while 1:
+            try:
+                chunk = os.read(self.fd, 4096)
+            except exceptions.OSError, e:
+                if e.errno == errno.EAGAIN:
+                    break
+                raise
+            if chunk == '':
+                break
+            data += chunk
+        return data
+
+    # split received bytes into frames, skipping bytes that cannot start
+    # a frame until the stream is back in sync.  A frame may straddle
+    # two calls.
+    def ParseFrames(self, data):
+        if self.dialproto:
+            skipped = self.ParseFramesNative(data)
+        else:
+            skipped = self.ParseFramesPython(data)
+        if skipped:
             print 'dialbox: missed a few bytes'
-            return None
+            self.resyncs += skipped
+
+    def ParseFramesNative(self, data):
+        n = len(data) / 3 + 1
+        dials = (ctypes.c_uint8 * n)()
+        values = (ctypes.c_uint16 * n)()
+        skipped = ctypes.c_uint(0)
+        frames = self.dialproto.dialproto_parse(self.parser, data, len(data),
+                                                dials, values, n, ctypes.byref(skipped))
+        for i in range(frames):
+            self.Frame(dials[i], values[i])
+        return skipped.value
+
+    # the state machine of parseDialFrame
+    def ParseFramesPython(self, data):
+        skipped = 0
+        for c in data:
+            c = ord(c)
+            if self.frame_count == 0:
+                if c >= self.DIAL_BASE and c < self.DIAL_BASE + 8:
+                    self.frame_dial = c - self.DIAL_BASE
+                    self.frame_count = 1
+                else:
+                    skipped += 1
+            elif self.frame_count == 1:
+                self.frame_value = c << 8
+                self.frame_count = 2
+            else:
+                self.Frame(self.frame_dial, self.frame_value | c)
+                self.frame_count = 0
+        return skipped
 
+    def Frame(self, dial, val):
         if self.model == SGI:
-            value = val - self.dial[dial]
             self.dial[dial] = val
-        elif self.model == SPECTRAGRAPHICS:
-            value = b2-b3
-        else:
-            return None
-        return (dial,val) #ue
+        self.event_queue.append((dial, val))
+
+    def waitevent(self):
+        while len(self.event_queue) == 0:
+            if self.fd < 0:
+                return None
+            if hasattr(select, 'epoll'):
+                r = self.poll.poll(self.timeout / 1000.0)
+            else:
+                r = self.poll.poll(self.timeout)
+            if len(r) == 0:
+                return None
+            self.ParseFrames(self.ReadAvailable())
+        return self.event_queue.popleft()
+
 
+# evdev device names of the dial-like devices queue opens by default,
+# e.g. "Griffin PowerMate"
+DIAL_DEVICE_NAMES = ('PowerMate', 'Dial')
 
 class queue:
-    def __init__(self, dev=None, timeout=1):
+    RING_EVENTS = 4096 # events buffered between kernel and consumer
+
+    # open dev, or every /dev/input/event* whose device name contains
+    # name, or one of the names if it is a tuple (all of them if name is
+    # None), and wait on all of them at once.  Up to 256 devices.
+    def __init__(self, dev=None, timeout=1, name=DIAL_DEVICE_NAMES):
         self.timeout = 1000 * timeout
-        self.handle = -1
+        self.handles = {}
+        self.devices = [] # file names, indexed by source number
+        self.source_of = {} # handle -> source number
+        if isinstance(name, str):
+            name = (name,)
+        if hasattr(select, 'epoll'):
+            self.poll = select.epoll()
+            self.poll_in = select.EPOLLIN
+        else:
+            self.poll = select.poll()
+            self.poll_in = select.POLLIN
         if dev:
             if not self.OpenDevice(dev):
                 raise exceptions.RuntimeError, 'eventio-error: unable to find requested device'
         else:
-            ok = 0
-            for d in range(0, 16):
-                if self.OpenDevice("/dev/input/event%d" % d):
-                    ok = 1
-                    break
-            if not ok:
+            for filename in sorted(glob.glob('/dev/input/event*')):
+                if name is None or [n for n in name if n in self.DeviceName(filename)]:
+                    self.OpenDevice(filename)
+            if len(self.handles) == 0:
                 raise exceptions.RuntimeError, 'Unable to find powermate'
-        self.poll = select.poll()
-        self.poll.register(self.handle, select.POLLIN)
-        self.event_queue = [] # queue used to reduce kernel/userspace context switching
+
+        # events are read straight into this ring and handed out as views
+        # of it.  head and tail count bytes and are used modulo its size.
+        self.ring = bytearray(input_event_size * self.RING_EVENTS)
+        self.ring_view = memoryview(self.ring)
+        self.head = 0 # next byte to be written by the kernel
+        self.tail = 0 # next byte to be consumed
+        # source number of the device each event in the ring came from,
+        # one byte per event
+        self.sources = bytearray(self.RING_EVENTS)
+        self.sources_view = memoryview(self.sources)
+        self.source = None # source of the event last returned by waitevent
 
     def __del__(self):
-        if self.handle >= 0:
-            self.poll.unregister(self.handle)
-            os.close(self.handle)
-            self.handle = -1
-            del self.poll
-            
+        for handle in self.handles.keys():
+            self.CloseDevice(handle)
+
+    def DeviceName(self, filename):
+        try:
+            handle = os.open(filename, os.O_RDONLY | os.O_NONBLOCK)
+        except exceptions.OSError:
+            return ''
+        try:
+            buf = array.array('B', [0] * 256)
+            try:
+                fcntl.ioctl(handle, EVIOCGNAME(len(buf)), buf, True)
+            except exceptions.IOError:
+                return ''
+            return buf.tostring().split('\0', 1)[0]
+        finally:
+            os.close(handle)
+
     def OpenDevice(self, filename):
         try:
-            self.handle = os.open(filename, os.O_RDWR)
-            if self.handle < 0:
-                return 0
-            fcntl.fcntl(self.handle, fcntl.F_SETFL, os.O_NDELAY)
-            return 1
+            handle = os.open(filename, os.O_RDWR | os.O_NONBLOCK)
         except exceptions.OSError:
             return 0
+        self.handles[handle] = io.FileIO(handle, 'r', closefd=False)
+        self.source_of[handle] = len(self.devices)
+        self.devices.append(filename)
+        self.poll.register(handle, self.poll_in)
+        return 1
 
-    def waitevent(self): # timeout in seconds
-        if len(self.event_queue) > 0:
-            return self.event_queue.pop(0)
-        if self.handle < 0:
+    def CloseDevice(self, handle):
+        self.poll.unregister(handle)
+        del self.handles[handle]
+        del self.source_of[handle]
+        os.close(handle)
+
+    # read as many events as fit into the ring from every readable device
+    def Fill(self, handle):
+        size = len(self.ring)
+        while self.head - self.tail < size:
+            start = self.head % size
+            end = min(size, start + size - (self.head - self.tail))
+            try:
+                n = self.handles[handle].readinto(self.ring_view[start:end])
+            except exceptions.IOError, e:
+                if e.errno == errno.ENODEV: # device has been disconnected
+                    self.CloseDevice(handle)
+                return
+            if not n:
+                return
+            first = start / input_event_size
+            count = n / input_event_size
+            self.sources[first:first + count] = chr(self.source_of[handle]) * count
+            self.head += n
+
+    def Wait(self):
+        if len(self.handles) == 0:
+            return 0
+        if hasattr(select, 'epoll'):
+            r = self.poll.poll(self.timeout / 1000.0)
+        else:
+            r = self.poll.poll(int(self.timeout))
+        for (handle, mask) in r:
+            self.Fill(handle)
+        return len(r)
+
+    # zero-copy batch interface: returns a memoryview of the contiguous
+    # run of buffered events, which stays valid until consume() is
+    # called for it, and a memoryview of their source numbers, one byte
+    # per event (tolist() gives ints), which index self.devices.  Decode
+    # the events with struct.unpack_from(input_event_struct).
+    def waitevents(self):
+        if self.head == self.tail and not self.Wait():
             return None
-        r = self.poll.poll(int(self.timeout))
-        if len(r) == 0:
+        if self.head == self.tail:
             return None
-        return self.GetEvent()
-        
-    def GetEvent(self): # only call when descriptor is readable
-        if self.handle < 0:
+        size = len(self.ring)
+        start = self.tail % size
+        end = min(size, start + self.head - self.tail)
+        return (self.ring_view[start:end],
+                self.sources_view[start / input_event_size:end / input_event_size])
+
+    def consume(self, nbytes):
+        self.tail += nbytes
+
+    def waitevent(self): # timeout in seconds
+        if self.head == self.tail and not self.Wait():
             return None
-        try:
-            data = os.read(self.handle, input_event_size * 32)
-            while data != '':
-                self.event_queue.append(struct.unpack(input_event_struct, data[0:input_event_size]))
-                data = data[input_event_size:]
-            return self.event_queue.pop(0)
-        except exceptions.OSError, e: # Errno 11: Resource temporarily unavailable
-            #if e.errno == 19: # device has been disconnected
-            #    report("PowerMate disconnected! Urgent!");
+        if self.head == self.tail:
             return None
+        offset = self.tail % len(self.ring)
+        event = struct.unpack_from(input_event_struct, self.ring, offset)
+        self.source = self.sources[offset / input_event_size]
+        self.tail += input_event_size
+        return event
 
 def usage():
     print 'usage: %s DEVICE (where EV_QUEUE is either /dev/input/event* for USB HID devices or /dev/ttyS* for serial line devices)' % (argv[0])
@@ -31,7 +31,12 @@
 #include <string.h>
 
 #include "Descriptors.h"
+#include "MIDI.h"
+#include "dialproto.h"
 #include "uart.h"
+#if DIAL_BOXES > 1
+#include "softuart.h"
+#endif
 
 #include <LUFA/Drivers/Board/LEDs.h>
 #include <LUFA/Drivers/USB/USB.h>
@@ -107,6 +112,13 @@ void SetupHardware(void)
   uart_putchar(0x50);
   uart_putchar(0x00);
   uart_putchar(0xFF);
+#if DIAL_BOXES > 1
+  softuart_init();
+  softuart_putchar(0x20);
+  softuart_putchar(0x50);
+  softuart_putchar(0x00);
+  softuart_putchar(0xFF);
+#endif
   _delay_ms(100);
   LED_ON;
 }
@@ -127,61 +139,219 @@ sendMidiCc(uint8_t ccNumber, uint8_t value)
   MIDI_Device_SendEventPacket(&Keyboard_MIDI_Interface, &MIDIEvent);
 }
 
+void
+sendSysEx(const uint8_t* data, uint8_t length)
+{
+  // Split a complete F0 ... F7 message into USB MIDI event packets.
+  // All but the last packet carry three bytes, the last packet's
+  // code index number tells the host how many bytes remain.
+
+  while (length) {
+    MIDI_EventPacket_t MIDIEvent = { 0 };
+    uint8_t count;
+
+    if (length > 3) {
+      count = 3;
+      MIDIEvent.Event = MIDI_EVENT(0, MIDI_COMMAND_SYSEX_START_3BYTE);
+    } else {
+      count = length;
+      MIDIEvent.Event = (count == 3) ? MIDI_EVENT(0, MIDI_COMMAND_SYSEX_END_3BYTE)
+        : (count == 2) ? MIDI_EVENT(0, MIDI_COMMAND_SYSEX_END_2BYTE)
+        : MIDI_EVENT(0, MIDI_COMMAND_SYSEX_END_1BYTE);
+    }
+
+    MIDIEvent.Data1 = data[0];
+    if (count > 1) {
+      MIDIEvent.Data2 = data[1];
+    }
+    if (count > 2) {
+      MIDIEvent.Data3 = data[2];
+    }
 
-#define BASE_CC 20
+    MIDI_Device_SendEventPacket(&Keyboard_MIDI_Interface, &MIDIEvent);
+    data += count;
+    length -= count;
+  }
+  MIDI_Device_Flush(&Keyboard_MIDI_Interface);
+}
 
-static uint16_t dialValues[8];
+static uint16_t dialValues[DIAL_COUNT];
 
 ISR(USART1_RX_vect)
 {
-  static uint8_t uartInputCount = 0;
-  static uint8_t dialNumber;
-  static uint16_t dialValue;
-
-  uint8_t c = UDR1;
-  switch (uartInputCount) {
-  case 0:
-    if ((c >= 0x30) && (c < 0x38)) {
-      dialNumber = c - 0x30;
-      uartInputCount = 1;
-    }
+  static DialFrameParser_t parser;
+
+  uint8_t dialNumber;
+  uint16_t dialValue;
+
+  if (parseDialFrame(&parser, UDR1, &dialNumber, &dialValue)) {
+    dialValues[dialNumber] = dialValue;
+  }
+}
+
+#if DIAL_BOXES > 1
+// The second dial box's dials follow those of the first one, both in
+// dialValues and in the CC numbers they are reported on.
+void
+softuart_receive(uint8_t c)
+{
+  static DialFrameParser_t parser;
+
+  uint8_t dialNumber;
+  uint16_t dialValue;
+
+  if (parseDialFrame(&parser, c, &dialNumber, &dialValue)) {
+    dialValues[DIALS_PER_BOX + dialNumber] = dialValue;
+  }
+}
+#endif
+
+static uint16_t oldDialValues[DIAL_COUNT];
+
+/* Jitter filter.  A dial that reverses direction, or starts moving
+   from rest, has to move by more than its deadband before it is
+   reported.  Further movement in the same direction is reported count
+   by count, so small deliberate turns stay responsive while an encoder
+   flipping between two adjacent positions produces no traffic.  The
+   deadband of each dial can be set with the SysEx command
+   F0 7D 03 <dial> <deadband> F7.  */
+#define DEADBAND_DEFAULT 1
+
+static uint8_t deadband[DIAL_COUNT] = {
+  [0 ... DIAL_COUNT - 1] = DEADBAND_DEFAULT
+};
+static int8_t dialDirection[DIAL_COUNT];
+static uint16_t polledDialValues[DIAL_COUNT];
+static uint16_t suppressedCount[DIAL_COUNT];
+
+void
+sendDialReport(uint8_t type, const uint16_t* values)
+{
+  // One 16 bit value per dial in one SysEx message:
+  //
+  //   F0 7D <type> <dial 0: 3 bytes> ... <dial n: 3 bytes> F7
+  //
+  // SYSEX_SNAPSHOT reports the absolute position of all dials.  The
+  // values reported are those the host has already seen as deltas, so
+  // any deltas sent after the snapshot apply on top of it.
+  //
+  // SYSEX_FILTER_STATS reports the number of dial changes suppressed by
+  // the jitter filter.  The counters wrap around at 65536.
+
+  uint8_t message[3 + DIAL_COUNT * 3 + 1];
+  uint8_t* p = message;
+
+  *p++ = SYSEX_START;
+  *p++ = SYSEX_MANUFACTURER_ID;
+  *p++ = type;
+  for (uint8_t dialNumber = 0; dialNumber < DIAL_COUNT; dialNumber++) {
+    p = packSysExValue(p, values[dialNumber]);
+  }
+  *p++ = SYSEX_END;
+
+  sendSysEx(message, sizeof message);
+}
+
+/* Incoming SysEx commands, assembled from USB MIDI event packets.  A
+   command longer than the buffer is dropped. */
+#define SYSEX_COMMAND_MAX 8
+
+static uint8_t sysExCommand[SYSEX_COMMAND_MAX];
+static uint8_t sysExCommandLength;
+
+static void
+handleSysExCommand(void)
+{
+  if ((sysExCommandLength == 6)
+      && (sysExCommand[1] == SYSEX_MANUFACTURER_ID)
+      && (sysExCommand[2] == SYSEX_SET_DEADBAND)
+      && (sysExCommand[3] < DIAL_COUNT)) {
+    deadband[sysExCommand[3]] = sysExCommand[4];
+  }
+}
+
+/* Collect the bytes of a SysEx event packet.  Returns false if the
+   packet is not part of a SysEx message. */
+static bool
+receiveSysEx(const MIDI_EventPacket_t* event)
+{
+  uint8_t count;
+
+  switch (event->Event) {
+  case MIDI_EVENT(0, MIDI_COMMAND_SYSEX_START_3BYTE):
+  case MIDI_EVENT(0, MIDI_COMMAND_SYSEX_END_3BYTE):
+    count = 3;
     break;
-  case 1:
-    dialValue = c << 8;
-    uartInputCount = 2;
+  case MIDI_EVENT(0, MIDI_COMMAND_SYSEX_END_2BYTE):
+    count = 2;
     break;
-  case 2:
-    dialValue |= c;
-    dialValues[dialNumber] = dialValue;
-    uartInputCount = 0;
+  case MIDI_EVENT(0, MIDI_COMMAND_SYSEX_END_1BYTE):
+    count = 1;
     break;
+  default:
+    return false;
+  }
+
+  const uint8_t bytes[3] = { event->Data1, event->Data2, event->Data3 };
+
+  if (bytes[0] == SYSEX_START) {
+    sysExCommandLength = 0;
+  }
+  for (uint8_t i = 0; i < count; i++) {
+    // One past the buffer marks a command that is too long
+    if (sysExCommandLength < SYSEX_COMMAND_MAX) {
+      sysExCommand[sysExCommandLength] = bytes[i];
+    }
+    if (sysExCommandLength <= SYSEX_COMMAND_MAX) {
+      sysExCommandLength++;
+    }
   }
-}
 
-static uint16_t oldDialValues[8];
+  if (event->Event != MIDI_EVENT(0, MIDI_COMMAND_SYSEX_START_3BYTE)) {
+    handleSysExCommand();
+    sysExCommandLength = 0;
+  }
+  return true;
+}
 
 void
 pollDialValues(void)
 {
-  for (uint8_t dialNumber = 0; dialNumber < 8; dialNumber++) {
+  for (uint8_t dialNumber = 0; dialNumber < DIAL_COUNT; dialNumber++) {
     uint16_t dialValue;
 
     cli();
     dialValue = dialValues[dialNumber];
     sei();
 
+    // Only count suppressed changes, not every poll that sees them
+    bool changed = (dialValue != polledDialValues[dialNumber]);
+    polledDialValues[dialNumber] = dialValue;
+
     int16_t delta = dialValue - oldDialValues[dialNumber];
 
-    while (delta) {
-      int8_t value;
-      if (delta > 0) {
-        value = (delta > 63) ? 63 : delta;
-      } else if (delta < 0) {
-        value = (delta < -63) ? -63 : delta;
+    if (!delta) {
+      continue;
+    }
+
+    int8_t direction = (delta > 0) ? 1 : -1;
+    if (direction != dialDirection[dialNumber]) {
+      uint16_t distance = (delta > 0) ? delta : -delta;
+      if (distance <= deadband[dialNumber]) {
+        // Keep oldDialValues so that slow movement accumulates
+        if (changed) {
+          suppressedCount[dialNumber]++;
+        }
+        continue;
       }
-      delta -= value;
-      value &= 0x7f;
-      sendMidiCc(BASE_CC + dialNumber, value);
+      dialDirection[dialNumber] = direction;
+    }
+
+    while (delta) {
+      uint8_t controller;
+      uint8_t value;
+      encodeDialDelta(dialNumber, &delta, &controller, &value);
+      sendMidiCc(controller, value);
     }
     MIDI_Device_Flush(&Keyboard_MIDI_Interface);
 
@@ -209,7 +379,13 @@ main(void)
       if ((ReceivedMIDIEvent.Event == MIDI_EVENT(0, MIDI_COMMAND_NOTE_ON))
           && (ReceivedMIDIEvent.Data3 > 0)) {
         uint8_t note = ReceivedMIDIEvent.Data2;
-        if (note == bootloaderChord[bootloaderChordCount]) {
+        if (note == SNAPSHOT_REQUEST_NOTE) {
+          sendDialReport(SYSEX_SNAPSHOT, oldDialValues);
+          bootloaderChordCount = 0;
+        } else if (note == FILTER_STATS_REQUEST_NOTE) {
+          sendDialReport(SYSEX_FILTER_STATS, suppressedCount);
+          bootloaderChordCount = 0;
+        } else if (note == bootloaderChord[bootloaderChordCount]) {
           bootloaderChordCount++;
           if (bootloaderChordCount == bootloaderChordLength) {
             jumpToLoader();
@@ -218,6 +394,8 @@ main(void)
           bootloaderChordCount = 0;
         }
         LEDs_SetAllLEDs(ReceivedMIDIEvent.Data2 > 64 ? LEDS_LED1 : LEDS_LED2);
+      } else if (receiveSysEx(&ReceivedMIDIEvent)) {
+        // Handled as it completes
       } else {
         LEDs_SetAllLEDs(LEDS_NO_LEDS);
       }
@@ -53,6 +53,10 @@
 /* Function Prototypes: */
 void SetupHardware(void);
 
+/* Kept out of line so that "make profile" can attribute cycles to them. */
+void sendMidiCc(uint8_t ccNumber, uint8_t value) ATTR_NO_INLINE;
+void pollDialValues(void) ATTR_NO_INLINE;
+
 void EVENT_USB_Device_Connect(void);
 void EVENT_USB_Device_Disconnect(void);
 void EVENT_USB_Device_ConfigurationChanged(void);
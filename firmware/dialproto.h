@@ -0,0 +1,163 @@
+/* SGI Dialbox protocol core (hans.huebner@gmail.com) */
+
+/*
+  Everything that knows the wire formats lives here: the dial box's
+  serial frames, the CC encoding of dial movement, the host commands
+  and the SysEx messages with their 7 bit packing.  The header depends only on <stdint.h> and
+  <stdbool.h> and allocates nothing, so it builds unchanged for the
+  AVR and for host tools.  host/ builds it into a shared library for
+  dialbox.py and into a program that checks and benchmarks it and
+  generates test vectors for the Node relays' decoders, see
+  host/Makefile.
+
+  Defaults can be overridden before including the header:
+
+  DIAL_BOXES    number of dial boxes connected, 1 or 2
+  BASE_CC       first controller number used for dial movement
+  DIAL_ENCODING DIAL_ENCODING_TWOS_COMPLEMENT: one controller per dial,
+                value is the signed delta as a 7 bit two's complement
+                number
+                DIAL_ENCODING_SIGN_PAIR: two controllers per dial,
+                BASE_CC + 2 * dial for negative and BASE_CC + 2 * dial + 1
+                for positive movement, value is the magnitude
+*/
+
+#ifndef _DIALPROTO_H_
+#define _DIALPROTO_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define DIAL_ENCODING_TWOS_COMPLEMENT 0
+#define DIAL_ENCODING_SIGN_PAIR       1
+
+#define DIALS_PER_BOX 8
+
+#ifndef DIAL_BOXES
+#define DIAL_BOXES 1
+#endif
+
+#if DIAL_BOXES < 1 || DIAL_BOXES > 2
+#error "DIAL_BOXES must be 1 or 2"
+#endif
+
+/* The frame parser yields dial numbers up to DIALS_PER_BOX - 1 per box,
+   which index arrays of DIAL_COUNT entries, so DIAL_COUNT follows from
+   DIAL_BOXES */
+#ifndef DIAL_COUNT
+#define DIAL_COUNT (DIAL_BOXES * DIALS_PER_BOX)
+#elif DIAL_COUNT != DIAL_BOXES * DIALS_PER_BOX
+#error "DIAL_COUNT must be DIAL_BOXES * DIALS_PER_BOX"
+#endif
+
+#ifndef BASE_CC
+#define BASE_CC 20
+#endif
+
+#ifndef DIAL_ENCODING
+#define DIAL_ENCODING DIAL_ENCODING_TWOS_COMPLEMENT
+#endif
+
+/* Controllers used for dial movement, all of which must be valid 7 bit
+   controller numbers */
+#if DIAL_ENCODING == DIAL_ENCODING_SIGN_PAIR
+#define DIAL_CC_COUNT (2 * DIAL_COUNT)
+#else
+#define DIAL_CC_COUNT DIAL_COUNT
+#endif
+
+#if BASE_CC + DIAL_CC_COUNT > 128
+#error "BASE_CC and DIAL_COUNT put dial controllers above 127"
+#endif
+
+/* Serial frames are 0x30 + dial followed by the dial's absolute
+   position, 16 bits big endian. */
+#define DIAL_FRAME_BASE   0x30
+#define DIAL_FRAME_LENGTH 3
+
+/* Largest delta carried by one CC message */
+#define DIAL_MAX_STEP 63
+
+/* Host commands, sent to the device as Note On events */
+#define SNAPSHOT_REQUEST_NOTE     127
+#define FILTER_STATS_REQUEST_NOTE 126
+
+/* SysEx messages are F0 7D <type> <data> F7 */
+#define SYSEX_START             0xf0
+#define SYSEX_END               0xf7
+#define SYSEX_MANUFACTURER_ID   0x7d    /* non-commercial / educational use */
+#define SYSEX_SNAPSHOT          0x01
+#define SYSEX_FILTER_STATS      0x02
+#define SYSEX_SET_DEADBAND      0x03    /* host to device: <dial> <deadband> */
+
+typedef struct
+{
+  uint8_t count;
+  uint8_t dialNumber;
+  uint16_t dialValue;
+} DialFrameParser_t;
+
+/* Feed one received byte into the frame parser.  Returns true when
+   the byte completes a frame, with the frame's contents stored in
+   *dialNumber and *dialValue.  Bytes that cannot start a frame are
+   skipped. */
+static inline bool
+parseDialFrame(DialFrameParser_t* parser, uint8_t c,
+               uint8_t* dialNumber, uint16_t* dialValue)
+{
+  switch (parser->count) {
+  case 0:
+    if ((c >= DIAL_FRAME_BASE) && (c < DIAL_FRAME_BASE + DIALS_PER_BOX)) {
+      parser->dialNumber = c - DIAL_FRAME_BASE;
+      parser->count = 1;
+    }
+    break;
+  case 1:
+    parser->dialValue = c << 8;
+    parser->count = 2;
+    break;
+  case 2:
+    *dialNumber = parser->dialNumber;
+    *dialValue = parser->dialValue | c;
+    parser->count = 0;
+    return true;
+  }
+  return false;
+}
+
+/* Take the next step of at most DIAL_MAX_STEP counts off *delta, which
+   must be non-zero, and return the CC message that carries it */
+static inline void
+encodeDialDelta(uint8_t dialNumber, int16_t* delta,
+                uint8_t* controller, uint8_t* value)
+{
+  int8_t step;
+
+  if (*delta > 0) {
+    step = (*delta > DIAL_MAX_STEP) ? DIAL_MAX_STEP : *delta;
+  } else {
+    step = (*delta < -DIAL_MAX_STEP) ? -DIAL_MAX_STEP : *delta;
+  }
+  *delta -= step;
+
+#if DIAL_ENCODING == DIAL_ENCODING_SIGN_PAIR
+  *controller = BASE_CC + 2 * dialNumber + (step > 0);
+  *value = (step > 0) ? step : -step;
+#else
+  *controller = BASE_CC + dialNumber;
+  *value = step & 0x7f;
+#endif
+}
+
+/* 16 bit value as three 7 bit bytes, most significant first, for use
+   in SysEx messages */
+static inline uint8_t*
+packSysExValue(uint8_t* p, uint16_t value)
+{
+  *p++ = (value >> 14) & 0x03;
+  *p++ = (value >> 7) & 0x7f;
+  *p++ = value & 0x7f;
+  return p;
+}
+
+#endif
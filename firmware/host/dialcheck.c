@@ -0,0 +1,263 @@
+/* Host check and benchmark for dialproto.h (hans.huebner@gmail.com) */
+
+/*
+  Checks the frame parser, the CC encoding of dial movement and the
+  SysEx packing against known values, then measures how fast the parser
+  and the encoder run.  Exits with status 1 if a check fails.
+
+  With -v, prints test vectors instead, one JSON object per line, for
+  server/dialproto-check.js to run through the Node relays' decoders:
+
+  {"config": {"dialCount": n, "baseCc": n, "encoding": n,
+              "snapshotRequestNote": n, "filterStatsRequestNote": n}}
+  {"dial": n, "delta": n, "messages": [[controller, value], ...]}
+  {"values": [n, ...], "sysex": [byte, ...]}
+  {"bytes": [byte, ...], "frames": [[dial, value], ...], "skipped": n}
+
+  usage: dialcheck [-v]
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../dialproto.h"
+
+#define BENCH_BYTES (3 * 1000000)
+
+static int failures;
+
+static void
+check(bool ok, const char* what)
+{
+  if (!ok) {
+    printf("FAIL: %s\n", what);
+    failures++;
+  }
+}
+
+static int
+parse(DialFrameParser_t* parser, const uint8_t* bytes, int length,
+      uint8_t* dialNumbers, uint16_t* dialValues)
+{
+  int frames = 0;
+
+  for (int i = 0; i < length; i++) {
+    if (parseDialFrame(parser, bytes[i], &dialNumbers[frames], &dialValues[frames])) {
+      frames++;
+    }
+  }
+  return frames;
+}
+
+static void
+checkParser(void)
+{
+  // Garbage before and between frames, and a frame split across calls
+  static const uint8_t stream[] = { 0x12, 0x9a, 0x31, 0xff, 0xfe, 0x56, 0x37, 0x00 };
+  static const uint8_t rest[] = { 0x20, 0x30, 0x12, 0x34 };
+  DialFrameParser_t parser = { 0 };
+  uint8_t dialNumbers[4];
+  uint16_t dialValues[4];
+
+  int frames = parse(&parser, stream, sizeof stream, dialNumbers, dialValues);
+  check(frames == 1 && dialNumbers[0] == 1 && dialValues[0] == 0xfffe,
+        "parser skips garbage before a frame");
+  frames = parse(&parser, rest, sizeof rest, dialNumbers, dialValues);
+  check(frames == 2 && dialNumbers[0] == 7 && dialValues[0] == 0x0020
+        && dialNumbers[1] == 0 && dialValues[1] == 0x1234,
+        "parser resynchronizes and completes split frames");
+}
+
+static int
+encode(uint8_t dialNumber, int16_t delta, uint8_t (*messages)[2])
+{
+  int count = 0;
+
+  while (delta) {
+    encodeDialDelta(dialNumber, &delta, &messages[count][0], &messages[count][1]);
+    count++;
+  }
+  return count;
+}
+
+static int
+decode(const uint8_t* message, uint8_t* dialNumber)
+{
+#if DIAL_ENCODING == DIAL_ENCODING_SIGN_PAIR
+  *dialNumber = (message[0] - BASE_CC) >> 1;
+  return ((message[0] - BASE_CC) & 1) ? message[1] : -message[1];
+#else
+  *dialNumber = message[0] - BASE_CC;
+  return (message[1] & 0x40) ? message[1] - 0x80 : message[1];
+#endif
+}
+
+static void
+checkEncoder(void)
+{
+  static const int16_t deltas[] = { 1, -1, 63, -63, 64, -64, 200, -200, 32767, -32768 };
+  uint8_t messages[1024][2];
+
+  for (uint8_t dial = 0; dial < DIAL_COUNT; dial++) {
+    for (unsigned i = 0; i < sizeof deltas / sizeof deltas[0]; i++) {
+      int count = encode(dial, deltas[i], messages);
+      int sum = 0;
+      bool ok = (count == (abs(deltas[i]) + DIAL_MAX_STEP - 1) / DIAL_MAX_STEP);
+
+      for (int j = 0; j < count; j++) {
+        uint8_t dialNumber;
+        sum += decode(messages[j], &dialNumber);
+        ok = ok && dialNumber == dial && messages[j][0] < 128 && messages[j][1] < 128;
+      }
+      check(ok && sum == deltas[i], "delta survives CC encoding");
+    }
+  }
+}
+
+static void
+checkSysEx(void)
+{
+  uint8_t bytes[3];
+
+  packSysExValue(bytes, 0xbeef);
+  check(bytes[0] == 0x02 && bytes[1] == 0x7d && bytes[2] == 0x6f,
+        "16 bit value packs into three 7 bit bytes");
+}
+
+static double
+seconds(void)
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+static void
+bench(void)
+{
+  uint8_t* stream = malloc(BENCH_BYTES);
+  uint8_t dialNumber;
+  uint16_t dialValue;
+  DialFrameParser_t parser = { 0 };
+  volatile unsigned sink = 0;
+
+  for (int i = 0; i < BENCH_BYTES; i += 3) {
+    stream[i] = DIAL_FRAME_BASE + i % DIALS_PER_BOX;
+    stream[i + 1] = i >> 8;
+    stream[i + 2] = i;
+  }
+
+  double start = seconds();
+  for (int i = 0; i < BENCH_BYTES; i++) {
+    if (parseDialFrame(&parser, stream[i], &dialNumber, &dialValue)) {
+      sink += dialValue;
+    }
+  }
+  double elapsed = seconds() - start;
+  printf("parseDialFrame:  %6.2f ns/byte\n", elapsed * 1e9 / BENCH_BYTES);
+
+  start = seconds();
+  for (int i = 0; i < BENCH_BYTES; i++) {
+    int16_t delta = (i & 0xff) - 0x80;
+    uint8_t controller, value;
+    while (delta) {
+      encodeDialDelta(i % DIAL_COUNT, &delta, &controller, &value);
+      sink += value;
+    }
+  }
+  elapsed = seconds() - start;
+  printf("encodeDialDelta: %6.2f ns/delta\n", elapsed * 1e9 / BENCH_BYTES);
+
+  free(stream);
+}
+
+static void
+printVectors(void)
+{
+  static const int16_t deltas[] = { 1, -1, 5, -5, 63, -63, 64, -64, 127, -128, 1000, -1000 };
+  static const uint16_t values[] = { 0, 1, 0x7f, 0x80, 0x3fff, 0x4000, 0x8000, 0xbeef, 0xffff };
+  uint8_t messages[32][2];
+
+  printf("{\"config\": {\"dialCount\": %d, \"baseCc\": %d, \"encoding\": %d, "
+         "\"snapshotRequestNote\": %d, \"filterStatsRequestNote\": %d}}\n",
+         DIAL_COUNT, BASE_CC, DIAL_ENCODING,
+         SNAPSHOT_REQUEST_NOTE, FILTER_STATS_REQUEST_NOTE);
+
+  for (uint8_t dial = 0; dial < DIAL_COUNT; dial++) {
+    for (unsigned i = 0; i < sizeof deltas / sizeof deltas[0]; i++) {
+      int count = encode(dial, deltas[i], messages);
+      printf("{\"dial\": %d, \"delta\": %d, \"messages\": [", dial, deltas[i]);
+      for (int j = 0; j < count; j++) {
+        printf("%s[%d, %d]", j ? ", " : "", messages[j][0], messages[j][1]);
+      }
+      printf("]}\n");
+    }
+  }
+
+  printf("{\"values\": [");
+  for (unsigned i = 0; i < sizeof values / sizeof values[0]; i++) {
+    printf("%s%d", i ? ", " : "", values[i]);
+  }
+  printf("], \"sysex\": [%d, %d, %d", SYSEX_START, SYSEX_MANUFACTURER_ID, SYSEX_SNAPSHOT);
+  for (unsigned i = 0; i < sizeof values / sizeof values[0]; i++) {
+    uint8_t bytes[3];
+    packSysExValue(bytes, values[i]);
+    printf(", %d, %d, %d", bytes[0], bytes[1], bytes[2]);
+  }
+  printf(", %d]}\n", SYSEX_END);
+
+  // Serial stream with garbage, a frame header inside it and a frame
+  // left incomplete at the end
+  static const uint8_t stream[] = {
+    0x30, 0x00, 0x05, 0x12, 0x9a, 0x37, 0xff, 0xfe, 0x7f, 0x34, 0x31, 0xff,
+    0x2f, 0x38, 0x31, 0x80, 0x00, 0x36, 0x12
+  };
+  DialFrameParser_t parser = { 0 };
+  int skipped = 0;
+  bool first = true;
+
+  printf("{\"bytes\": [");
+  for (unsigned i = 0; i < sizeof stream; i++) {
+    printf("%s%d", i ? ", " : "", stream[i]);
+  }
+  printf("], \"frames\": [");
+  for (unsigned i = 0; i < sizeof stream; i++) {
+    uint8_t dialNumber;
+    uint16_t dialValue;
+    bool wasIdle = (parser.count == 0);
+    if (parseDialFrame(&parser, stream[i], &dialNumber, &dialValue)) {
+      printf("%s[%d, %d]", first ? "" : ", ", dialNumber, dialValue);
+      first = false;
+    } else if (wasIdle && parser.count == 0) {
+      skipped++;
+    }
+  }
+  printf("], \"skipped\": %d}\n", skipped);
+}
+
+int
+main(int argc, char** argv)
+{
+  if (argc == 2 && !strcmp(argv[1], "-v")) {
+    printVectors();
+    return 0;
+  } else if (argc != 1) {
+    fprintf(stderr, "usage: %s [-v]\n", argv[0]);
+    return 1;
+  }
+
+  checkParser();
+  checkEncoder();
+  checkSysEx();
+  if (failures) {
+    printf("%d checks failed\n", failures);
+    return 1;
+  }
+  printf("all checks passed\n");
+
+  bench();
+  return 0;
+}
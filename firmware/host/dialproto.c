@@ -0,0 +1,41 @@
+/* dialproto.h as a shared library for host tools (hans.huebner@gmail.com) */
+
+/*
+  dialbox.py loads this with ctypes so that the serial frames from a
+  dial box are parsed by the same code as in the firmware.  The parser
+  state is opaque to the caller, who allocates dialproto_parser_size()
+  bytes of zeroed memory for it.
+*/
+
+#include <stddef.h>
+
+#include "../dialproto.h"
+
+size_t
+dialproto_parser_size(void)
+{
+  return sizeof (DialFrameParser_t);
+}
+
+/* Feed length bytes into the parser.  Stores up to maxFrames completed
+   frames in dialNumbers and dialValues and returns their number.  If
+   skipped is not NULL, the number of bytes that could not start a
+   frame is added to it. */
+int
+dialproto_parse(DialFrameParser_t* parser, const uint8_t* bytes, int length,
+                uint8_t* dialNumbers, uint16_t* dialValues, int maxFrames,
+                unsigned* skipped)
+{
+  int frames = 0;
+
+  for (int i = 0; i < length && frames < maxFrames; i++) {
+    uint8_t wasIdle = (parser->count == 0);
+
+    if (parseDialFrame(parser, bytes[i], &dialNumbers[frames], &dialValues[frames])) {
+      frames++;
+    } else if (wasIdle && parser->count == 0 && skipped) {
+      (*skipped)++;
+    }
+  }
+  return frames;
+}
@@ -0,0 +1,404 @@
+/* Cycle counting harness for the SGI Dialbox translator firmware */
+
+/*
+  Runs the firmware ELF in simavr, feeds a scripted byte stream into
+  USART1 at the dial box baud rate and reports, for every function
+  named on the command line, how often it ran, how many cycles each
+  invocation took and its share of the CPU while the scripts were
+  running.  Also reports the stack high-water mark.
+
+  With -2, a second script is sent concurrently as a bit level serial
+  signal on PD0, the software UART input for a second dial box.  With
+  -d and -n, the final contents of the firmware's dialValues array are
+  compared with the last position sent for each dial in the scripts,
+  as parsed by dialproto.h, and the exit status is 1 if they differ.
+
+  usage: dialprof [-m mcu] [-f f_cpu] [-b baud] [-r repeat] [-t tail_ms]
+                  -s script [-2 script] [-d address -n dials]
+                  firmware.elf name=address ...
+
+  The addresses are byte addresses as printed by avr-nm; the makefile's
+  "profile" target extracts them.  Cycle counts are inclusive: an
+  interrupt taken while a function runs is counted towards it.
+
+  The simulated USB controller is never enumerated by a host, so the
+  MIDI class driver returns early from every send.  The numbers for
+  sendMidiCc therefore cover the firmware's own work, not the endpoint
+  transfer, and USB interrupts do not show up at all.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+
+#include "sim_avr.h"
+#include "sim_elf.h"
+#include "sim_core.h"
+#include "avr_uart.h"
+#include "avr_ioport.h"
+
+#include "../dialproto.h"
+
+#define MAX_FUNCTIONS 16
+#define MAX_FRAMES    32
+#define MAX_SCRIPT    65536
+
+typedef struct
+{
+  const char* name;
+  avr_flashaddr_t address;
+  uint32_t calls;
+  uint64_t total;
+  uint64_t min;
+  uint64_t max;
+} function_t;
+
+typedef struct
+{
+  function_t* function;
+  uint16_t sp;
+  uint64_t start;
+} frame_t;
+
+static function_t functions[MAX_FUNCTIONS];
+static int functionCount;
+
+static frame_t frames[MAX_FRAMES];
+static int frameCount;
+
+typedef struct
+{
+  uint8_t bytes[MAX_SCRIPT];
+  int length;
+} script_t;
+
+static script_t script;
+static script_t script2;
+
+// The position a script leaves each dial at.  Dials the script does
+// not mention stay at zero.
+static void
+expectDialValues(const script_t* script, uint16_t* expected)
+{
+  DialFrameParser_t parser = { 0 };
+  uint8_t dialNumber;
+  uint16_t dialValue;
+
+  for (int i = 0; i < script->length; i++) {
+    if (parseDialFrame(&parser, script->bytes[i], &dialNumber, &dialValue)) {
+      expected[dialNumber] = dialValue;
+    }
+  }
+}
+
+static uint16_t
+getSp(avr_t* avr)
+{
+  return avr->data[R_SPL] | (avr->data[R_SPH] << 8);
+}
+
+static void
+readScript(script_t* script, const char* filename)
+{
+  // Whitespace separated hex bytes, '#' starts a comment
+
+  FILE* file = fopen(filename, "r");
+  if (!file) {
+    perror(filename);
+    exit(1);
+  }
+
+  int c;
+  while ((c = fgetc(file)) != EOF) {
+    if (c == '#') {
+      while ((c = fgetc(file)) != EOF && c != '\n')
+        ;
+    } else if (c != ' ' && c != '\t' && c != '\n' && c != '\r') {
+      unsigned value;
+      ungetc(c, file);
+      if (fscanf(file, "%x", &value) != 1 || value > 0xff) {
+        fprintf(stderr, "%s: invalid byte in script\n", filename);
+        exit(1);
+      }
+      if (script->length == MAX_SCRIPT) {
+        fprintf(stderr, "%s: script too long\n", filename);
+        exit(1);
+      }
+      script->bytes[script->length++] = value;
+    }
+  }
+  fclose(file);
+
+  if (!script->length) {
+    fprintf(stderr, "%s: empty script\n", filename);
+    exit(1);
+  }
+}
+
+static void
+addFunction(const char* spec)
+{
+  const char* equals = strchr(spec, '=');
+  if (!equals || functionCount == MAX_FUNCTIONS) {
+    fprintf(stderr, "invalid function specification %s\n", spec);
+    exit(1);
+  }
+
+  function_t* function = &functions[functionCount++];
+  function->name = strndup(spec, equals - spec);
+  function->address = strtoul(equals + 1, NULL, 0);
+  function->min = UINT64_MAX;
+}
+
+static void
+trackFrames(avr_t* avr)
+{
+  uint16_t sp = getSp(avr);
+
+  // A function has returned once the stack pointer is back above the
+  // return address pushed by its caller.
+  while (frameCount && sp > frames[frameCount - 1].sp) {
+    frame_t* frame = &frames[--frameCount];
+    uint64_t cycles = avr->cycle - frame->start;
+    function_t* function = frame->function;
+
+    function->calls++;
+    function->total += cycles;
+    if (cycles < function->min) {
+      function->min = cycles;
+    }
+    if (cycles > function->max) {
+      function->max = cycles;
+    }
+  }
+
+  for (int i = 0; i < functionCount; i++) {
+    if (avr->pc == functions[i].address) {
+      if (frameCount == MAX_FRAMES) {
+        fprintf(stderr, "call nesting too deep at %s\n", functions[i].name);
+        exit(1);
+      }
+      frames[frameCount++] = (frame_t) {
+        .function = &functions[i],
+        .sp       = sp,
+        .start    = avr->cycle
+      };
+    }
+  }
+}
+
+static void
+usage(const char* program)
+{
+  fprintf(stderr,
+          "usage: %s [-m mcu] [-f f_cpu] [-b baud] [-r repeat] [-t tail_ms]\n"
+          "          -s script [-2 script] [-d address -n dials]\n"
+          "          firmware.elf name=address ...\n",
+          program);
+  exit(1);
+}
+
+int
+main(int argc, char** argv)
+{
+  const char* mcu = "atmega32u4";
+  uint32_t frequency = 16000000;
+  uint32_t baud = 9600;
+  int repeat = 1;
+  uint32_t tailMs = 100;
+  const char* scriptFile = NULL;
+  const char* script2File = NULL;
+  uint32_t dialValuesAddress = 0;
+  int dialCount = 0;
+
+  int option;
+  while ((option = getopt(argc, argv, "m:f:b:r:t:s:2:d:n:")) != -1) {
+    switch (option) {
+    case 'm': mcu = optarg; break;
+    case 'f': frequency = strtoul(optarg, NULL, 0); break;
+    case 'b': baud = strtoul(optarg, NULL, 0); break;
+    case 'r': repeat = atoi(optarg); break;
+    case 't': tailMs = strtoul(optarg, NULL, 0); break;
+    case 's': scriptFile = optarg; break;
+    case '2': script2File = optarg; break;
+    case 'd': dialValuesAddress = strtoul(optarg, NULL, 0) & 0xffff; break;
+    case 'n': dialCount = atoi(optarg); break;
+    default: usage(argv[0]);
+    }
+  }
+
+  if (!scriptFile || optind >= argc) {
+    usage(argv[0]);
+  }
+
+  readScript(&script, scriptFile);
+  if (script2File) {
+    readScript(&script2, script2File);
+  }
+
+  const char* elfFile = argv[optind++];
+  while (optind < argc) {
+    addFunction(argv[optind++]);
+  }
+
+  elf_firmware_t firmware;
+  memset(&firmware, 0, sizeof firmware);
+  if (elf_read_firmware(elfFile, &firmware)) {
+    fprintf(stderr, "%s: cannot read firmware\n", elfFile);
+    return 1;
+  }
+
+  avr_t* avr = avr_make_mcu_by_name(mcu);
+  if (!avr) {
+    fprintf(stderr, "%s: unknown MCU\n", mcu);
+    return 1;
+  }
+  avr_init(avr);
+  avr_load_firmware(avr, &firmware);
+  avr->frequency = frequency;
+
+  avr_irq_t* uartInput = avr_io_getirq(avr, AVR_IOCTL_UART_GETIRQ('1'), UART_IRQ_INPUT);
+  avr_irq_t* softUartInput = avr_io_getirq(avr, AVR_IOCTL_IOPORT_GETIRQ('D'), 0);
+
+  // Idle line
+  avr_raise_irq(softUartInput, 1);
+
+  // One start bit, eight data bits, one stop bit per byte
+  const uint64_t cyclesPerByte = 10ULL * frequency / baud;
+  const uint64_t tailCycles = (uint64_t) tailMs * frequency / 1000;
+
+  // The script is only fed once SetupHardware has finished, which is
+  // when the main loop polls the dials for the first time.
+  function_t* poll = NULL;
+  for (int i = 0; i < functionCount; i++) {
+    if (!strcmp(functions[i].name, "pollDialValues")) {
+      poll = &functions[i];
+    }
+  }
+
+  uint16_t minSp = UINT16_MAX;
+  uint64_t nextByte = 0;
+  uint64_t start = 0;
+  uint64_t end = 0;
+  int fed = 0;
+  const int toFeed = script.length * repeat;
+
+  // Bit level state of the software UART stream
+  uint64_t byteStart2 = 0;
+  int bit2 = 0;
+  int fed2 = 0;
+  const int toFeed2 = script2.length * repeat;
+
+  for (;;) {
+    int state = avr_run(avr);
+    if (state == cpu_Done || state == cpu_Crashed) {
+      fprintf(stderr, "simulation stopped (state %d)\n", state);
+      break;
+    }
+
+    trackFrames(avr);
+
+    // SP reads zero until the C runtime has set it up
+    uint16_t sp = getSp(avr);
+    if (sp && sp < minSp) {
+      minSp = sp;
+    }
+
+    if (poll && !poll->calls) {
+      continue;
+    }
+
+    if (!start) {
+      start = avr->cycle;
+      byteStart2 = start;
+    }
+
+    if (fed < toFeed && avr->cycle >= nextByte) {
+      avr_raise_irq(uartInput, script.bytes[fed % script.length]);
+      fed++;
+      nextByte = avr->cycle + cyclesPerByte;
+    }
+
+    // Start bit, eight data bits LSB first, stop bit.  Bit edges are
+    // computed from the byte start so that rounding does not add up.
+    if (fed2 < toFeed2
+        && avr->cycle >= byteStart2 + (uint64_t) bit2 * frequency / baud) {
+      uint8_t byte = script2.bytes[fed2 % script2.length];
+      int level = (bit2 == 0) ? 0 : (bit2 == 9) ? 1 : (byte >> (bit2 - 1)) & 1;
+      avr_raise_irq(softUartInput, level);
+      if (++bit2 == 10) {
+        bit2 = 0;
+        fed2++;
+        byteStart2 += cyclesPerByte;
+      }
+    }
+
+    if (fed < toFeed || fed2 < toFeed2) {
+      continue;
+    } else if (!end) {
+      end = avr->cycle + tailCycles;
+    } else if (avr->cycle >= end) {
+      break;
+    }
+  }
+
+  const uint64_t elapsed = avr->cycle - start;
+
+  printf("%-20s %10s %10s %10s %10s %14s %7s\n",
+         "function", "calls", "min", "max", "avg", "total", "%cpu");
+  for (int i = 0; i < functionCount; i++) {
+    function_t* function = &functions[i];
+    if (function->calls) {
+      printf("%-20s %10u %10llu %10llu %10llu %14llu %7.3f\n",
+             function->name, function->calls,
+             (unsigned long long) function->min,
+             (unsigned long long) function->max,
+             (unsigned long long) (function->total / function->calls),
+             (unsigned long long) function->total,
+             elapsed ? 100.0 * function->total / elapsed : 0.0);
+    } else {
+      printf("%-20s %10u\n", function->name, 0);
+    }
+  }
+
+  printf("\n%d + %d script bytes fed, %llu cycles simulated\n",
+         fed, fed2, (unsigned long long) avr->cycle);
+  printf("stack high-water: %u bytes (lowest SP 0x%04x, RAMEND 0x%04x)\n",
+         avr->ramend - minSp, minSp, avr->ramend);
+
+  printf("USB: not enumerated, endpoint transfers and USB interrupts excluded\n");
+
+  int mismatches = 0;
+  if (dialValuesAddress && dialCount) {
+    uint16_t expected[2 * DIALS_PER_BOX] = { 0 };
+    expectDialValues(&script, expected);
+    if (script2File) {
+      expectDialValues(&script2, expected + DIALS_PER_BOX);
+    }
+
+    printf("dialValues:");
+    for (int i = 0; i < dialCount; i++) {
+      uint16_t address = dialValuesAddress + 2 * i;
+      uint16_t value = avr->data[address] | (avr->data[address + 1] << 8);
+      printf(" %04x", value);
+      if (i < 2 * DIALS_PER_BOX && value != expected[i]) {
+        mismatches++;
+      }
+    }
+    printf("\n");
+
+    if (mismatches) {
+      printf("expected:  ");
+      for (int i = 0; i < dialCount && i < 2 * DIALS_PER_BOX; i++) {
+        printf(" %04x", expected[i]);
+      }
+      printf("\nFAIL: %d dials differ from the scripts\n", mismatches);
+    } else {
+      printf("PASS: all dials at the scripts' final positions\n");
+    }
+  }
+
+  return mismatches ? 1 : 0;
+}
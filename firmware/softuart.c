@@ -0,0 +1,93 @@
+/* Software UART for the SGI Dialbox translator firmware (hans.huebner@gmail.com) */
+
+// Reception is interrupt driven: the falling edge of the start bit
+// triggers INT0, after which Timer1 compare A interrupts sample the
+// eight data bits in their middle and check the stop bit.  Timer1 runs
+// freely at F_CPU, each compare interrupt advances OCR1A by one bit
+// time, so the sampling points do not drift with interrupt latency.
+//
+// Transmission is only needed to initialize the dial box, so it is
+// done by busy waiting with interrupts disabled.
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <util/delay.h>
+
+#include "softuart.h"
+
+#define RX_BIT      PD0
+#define TX_BIT      PD1
+#define BIT_TICKS   (F_CPU / SOFTUART_BAUD)
+#define BIT_US      (1000000.0 / SOFTUART_BAUD)
+
+static volatile uint8_t rx_bits;
+static volatile uint8_t rx_byte;
+
+// Initialize the software UART
+void softuart_init(void)
+{
+	cli();
+	DDRD &= ~(1<<RX_BIT);
+	PORTD |= (1<<RX_BIT);		// pull-up keeps an unconnected line idle
+	DDRD |= (1<<TX_BIT);
+	PORTD |= (1<<TX_BIT);
+	TCCR1A = 0;
+	TCCR1B = (1<<CS10);		// normal mode, no prescaling
+	TIMSK1 &= ~(1<<OCIE1A);
+	EICRA = (EICRA & ~((1<<ISC01) | (1<<ISC00))) | (1<<ISC01);	// falling edge
+	EIFR = (1<<INTF0);
+	EIMSK |= (1<<INT0);
+	sei();
+}
+
+// Transmit a byte, blocks for one character time
+void softuart_putchar(uint8_t c)
+{
+	uint8_t sreg = SREG;
+
+	cli();
+	PORTD &= ~(1<<TX_BIT);		// start bit
+	_delay_us(BIT_US);
+	for (uint8_t i = 0; i < 8; i++) {
+		if (c & 1) {
+			PORTD |= (1<<TX_BIT);
+		} else {
+			PORTD &= ~(1<<TX_BIT);
+		}
+		c >>= 1;
+		_delay_us(BIT_US);
+	}
+	PORTD |= (1<<TX_BIT);		// stop bit
+	_delay_us(BIT_US);
+	SREG = sreg;
+}
+
+// Start bit
+ISR(INT0_vect)
+{
+	OCR1A = TCNT1 + BIT_TICKS + BIT_TICKS / 2;
+	TIFR1 = (1<<OCF1A);
+	TIMSK1 |= (1<<OCIE1A);
+	EIMSK &= ~(1<<INT0);
+	rx_bits = 0;
+}
+
+// Data and stop bits
+ISR(TIMER1_COMPA_vect)
+{
+	uint8_t level = PIND & (1<<RX_BIT);
+
+	OCR1A += BIT_TICKS;
+	if (rx_bits < 8) {
+		rx_byte >>= 1;
+		if (level) rx_byte |= 0x80;
+		rx_bits++;
+	} else {
+		TIMSK1 &= ~(1<<OCIE1A);
+		EIFR = (1<<INTF0);
+		EIMSK |= (1<<INT0);
+		if (level) {		// drop bytes with a framing error
+			softuart_receive(rx_byte);
+		}
+	}
+}
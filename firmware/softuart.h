@@ -0,0 +1,19 @@
+#ifndef _softuart_included_h_
+#define _softuart_included_h_
+
+#include <stdint.h>
+
+// Software UART for a second dial box: 8N1 at SOFTUART_BAUD, receiving
+// on PD0 (INT0) and transmitting on PD1.  Uses Timer1 and its compare
+// A interrupt.
+
+#define SOFTUART_BAUD 9600
+
+void softuart_init(void);
+void softuart_putchar(uint8_t c);
+
+// Called from interrupt context for every byte received, must be
+// provided by the application.
+void softuart_receive(uint8_t c);
+
+#endif
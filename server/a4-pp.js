@@ -1,60 +1,101 @@
 
 midi = require('midi');
+var Worker = require('worker_threads').Worker;
+var Trace = require('./trace').Trace;
+var SpscQueue = require('./spsc').SpscQueue;
+var dialproto = require('./dialproto');
+var PortWatcher = require('./hotplug').PortWatcher;
 
-var values = [0,0,0,0,0,0,0,0];
-
-var input = new midi.input();
-var portNumber = undefined;
-
-for (var i = 0; i < input.getPortCount(); i++) {
-    if (input.getPortName(i) == 'SGI Dial Box') {
-        portNumber = i;
-        break;
-    }
-}
+// The wire format of the firmware as built by firmware/makefile
+var protocol = new dialproto.Protocol({ dialCount: 8 });
 
-if (portNumber == undefined) {
-    throw new Error('could not find SGI Dial Box');
-}
+var trace = new Trace(65536);
+trace.install(process.env.DIALBOX_TRACE || 'a4-pp-trace.bin',
+              { stdin: !!process.env.DIALBOX_TRACE_STDIN });
 
-input.openPort(portNumber);
+var values = [0,0,0,0,0,0,0,0];
 
 var output = new midi.output();
 
-var outputPorts = {};
-
 for (var i = 0; i < output.getPortCount(); i++) {
-    outputPorts[output.getPortName(i)] = i;
     console.log(output.getPortName(i));
 }
 
-//output.openVirtualPort('SGI Dial Box A4 PP');
-//output.openPort(outputPorts['Elektron Analog Four']);
-output.openPort(outputPorts['Maschine Controller MIDI output port 0']);
+// Messages are sent from a separate thread so that a slow or blocked
+// output port cannot delay input handling.
+var queue = SpscQueue.create(1024, 3);
+var outgoing = new Int32Array(3);
+
+//var outputPortName = 'Elektron Analog Four';
+var outputPortName = 'Maschine Controller MIDI output port 0';
+
+new Worker(__dirname + '/midi-output-worker.js', {
+    workerData: { queue: queue.buffer, portName: outputPortName }
+});
+
+process.on('SIGUSR2', function () {
+    console.error('output queue:', queue.overflows(), 'messages dropped');
+});
 
 var performance_cc = [
     3, 4, 8, 9, 64, 65, 66, 67
 ];
 
-input.on('message', function (deltaTime, message) {
+function onMessage(deltaTime, message) {
     if ((message[0] == 0xB0)
-        && (message[1] >= 102)
-        && (message[1] <= 118)) {
-        var cc = message[1] - 102;
-        var i = cc >> 1;
-        var value = message[2];
-        if (cc & 1) {
-            values[i] += value * value;
-        } else {
-            values[i] -= value * value;
-        }
+        && protocol.decodeDelta(message[1], message[2])) {
+        var i = protocol.dial;
+        values[i] += protocol.delta * Math.abs(protocol.delta);
         if (values[i] < 0) {
             values[i] = 0;
         } else if (values[i] > 1270) {
             values[i] = 1270;
         }
-        output.sendMessage([0xB0, performance_cc[i], Math.floor(values[i] / 10)]);
-        console.log(values);
+        var result = Math.floor(values[i] / 10);
+        outgoing[0] = 0xB0;
+        outgoing[1] = performance_cc[i];
+        outgoing[2] = result;
+        queue.push(outgoing);
+        trace.record(i, message[1], message[2], result);
     }
-});
+}
+
+// values survive a reconnect, so parameters do not jump when the dial
+// box comes back
+var input = undefined;
+var inputKey = undefined;
 
+// Port numbers of all dial boxes the watcher has reported, by key
+var ports = {};
+
+function openInput(key) {
+    inputKey = key;
+    input = new midi.input();
+    input.openPort(ports[key]);
+    input.on('message', onMessage);
+    console.log(key, 'connected');
+}
+
+// Only one dial box is relayed.  When it goes away, another one that is
+// still connected takes over.
+new PortWatcher(['SGI Dial Box'])
+    .on('add', function (key, name, portNumber) {
+        ports[key] = portNumber;
+        if (!input) {
+            openInput(key);
+        }
+    })
+    .on('remove', function (key) {
+        delete ports[key];
+        if (key == inputKey) {
+            input.closePort();
+            input = undefined;
+            inputKey = undefined;
+            console.log(key, 'disconnected');
+            var others = Object.keys(ports);
+            if (others.length) {
+                openInput(others[0]);
+            }
+        }
+    })
+    .start();
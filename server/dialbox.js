@@ -1,42 +1,222 @@
-
 midi = require('midi');
+var Trace = require('./trace').Trace;
+var dialproto = require('./dialproto');
+var PortWatcher = require('./hotplug').PortWatcher;
+var SerialDialBox = require('./serialbox').SerialDialBox;
 
-var values = [0,0,0,0,0,0,0,0];
+// Dial boxes to aggregate.  Each argument is either a MIDI port name to
+// watch, @ followed by the USB serial number of a box, or the path of
+// a serial port with a dial box connected directly.  Dial ranges are
+// reserved in argument order, for each serial number and serial port
+// and for the first box of each name that is not pinned by its serial
+// number.  Other boxes get the next free range when they first appear;
+// their serial numbers are logged so that they can be pinned.
+var args = process.argv.slice(2);
+var portNames = args.filter(function (arg) { return arg[0] != '@' && arg[0] != '/'; });
+var serialPorts = args.filter(function (arg) { return arg[0] == '/'; });
+if (!portNames.length) {
+    portNames.push('SGI Dial Box');
+}
 
-var input = new midi.input();
-var portNumber = undefined;
+// 16 for a converter built with DIAL_BOXES=2
+var DIALS_PER_DEVICE = parseInt(process.env.DIALBOX_DIALS || '8');
 
-for (var i = 0; i < input.getPortCount(); i++) {
-    if (input.getPortName(i) == 'SGI Dial Box') {
-        portNumber = i;
-        break;
-    }
-}
+// The wire format of the firmware as built by firmware/makefile
+var protocol = new dialproto.Protocol({ dialCount: DIALS_PER_DEVICE });
+
+// Devices by identity: @ and the serial number for boxes whose serial
+// number is known, the port watcher's key for others
+var devices = {};
+var deviceCount = 0;
+var values = [];
+
+// Dial n of the aggregate goes out on controller OUTPUT_BASE_CC + n
+var OUTPUT_BASE_CC = 80;
+var MAX_DEVICES = Math.floor((128 - OUTPUT_BASE_CC) / DIALS_PER_DEVICE);
 
-if (portNumber == undefined) {
-    throw new Error('could not find SGI Dial Box');
+var trace = new Trace(65536);
+trace.install(process.env.DIALBOX_TRACE || 'dialbox-trace.bin',
+              { stdin: !!process.env.DIALBOX_TRACE_STDIN });
+
+function findPorts(io, name) {
+    var ports = [];
+    for (var i = 0; i < io.getPortCount(); i++) {
+        if (io.getPortName(i) == name) {
+            ports.push(i);
+        }
+    }
+    return ports;
 }
 
-input.openPort(portNumber);
+var probeOutput = new midi.output();
 
 var output = new midi.output();
 
 output.openVirtualPort('SGI Dial Box CC');
 
-input.on('message', function (deltaTime, message) {
-    if ((message[0] == 0xB0)
-        && (message[1] >= 102)
-        && (message[1] <= 118)) {
-        var cc = message[1] - 102;
-        var i = cc >> 1;
-        var value = message[2];
-        if (cc & 1) {
-            values[i] += value * value;
+// Ranges reserved for the first box of a name, until it appears
+var namedDevices = {};
+
+function newDevice(label) {
+    if (deviceCount == MAX_DEVICES) {
+        console.log(label, 'ignored, no controllers left for its dials');
+        return undefined;
+    }
+    var device = {
+        offset: deviceCount++ * DIALS_PER_DEVICE,
+        // Absolute dial positions as reported by the firmware's
+        // snapshot response and kept current from the deltas,
+        // undefined until the first snapshot has been received.
+        positions: undefined,
+        // Set once the values have been seeded from a snapshot
+        seeded: false
+    };
+    for (var i = 0; i < DIALS_PER_DEVICE; i++) {
+        values.push(0);
+    }
+    console.log(label, 'dials', device.offset, 'to', device.offset + DIALS_PER_DEVICE - 1);
+    return device;
+}
+
+// A box keeps its dial range and accumulated values across unplugging
+// and replugging, so outputs continue where they left off.
+function getDevice(key, name, serial) {
+    var id = serial ? '@' + serial : key;
+    var device = devices[id];
+    if (!device) {
+        if (namedDevices[name]) {
+            device = namedDevices[name];
+            delete namedDevices[name];
+            console.log(key, 'uses the range reserved for', name);
         } else {
-            values[i] -= value * value;
+            device = newDevice(key);
+            if (!device) {
+                return undefined;
+            }
+        }
+        devices[id] = device;
+    }
+    return device;
+}
+
+args.forEach(function (arg) {
+    var device = newDevice(arg);
+    if (!device) {
+        return;
+    } else if (arg[0] == '@' || arg[0] == '/') {
+        devices[arg] = device;
+    } else {
+        namedDevices[arg] = device;
+    }
+});
+
+// The first snapshot from a box starts its outputs at the dials'
+// absolute positions rather than at zero.  Later snapshots, after the
+// box has been replugged, leave the accumulated values alone so that
+// outputs do not jump.
+function resync(device) {
+    if (device.seeded) {
+        return;
+    }
+    device.seeded = true;
+    var count = Math.min(DIALS_PER_DEVICE, device.positions.length);
+    for (var dial = 0; dial < count; dial++) {
+        var i = device.offset + dial;
+        var position = device.positions[dial];
+        values[i] = (position & 0x8000) ? position - 0x10000 : position;
+        output.sendMessage([0xB0, OUTPUT_BASE_CC + i, Math.abs(values[i] % 127)]);
+    }
+}
+
+// Relay the messages from a box, a midi.input or a SerialDialBox
+function listen(device, input) {
+    input.on('message', function (deltaTime, message) {
+        if (protocol.isSnapshot(message)) {
+            device.positions = dialproto.unpackSysExValues(message);
+            console.log('snapshot', device.offset, device.positions);
+            resync(device);
+        } else if ((message[0] == 0xB0)
+                   && protocol.decodeDelta(message[1], message[2])) {
+            var i = device.offset + protocol.dial;
+            if (device.positions) {
+                device.positions[protocol.dial] = (device.positions[protocol.dial] + protocol.delta) & 0xffff;
+            }
+            values[i] += protocol.delta * Math.abs(protocol.delta);
+            var result = Math.abs(values[i] % 127);
+            output.sendMessage([0xB0, OUTPUT_BASE_CC + i, result]);
+            trace.record(i, message[1], message[2], result);
         }
-        output.sendMessage([0xB0, i + 80, Math.abs(values[i] % 127)]);
-        console.log(values);
+    });
+}
+
+function connect(key, name, portNumber, serial) {
+    var device = getDevice(key, name, serial);
+    if (!device) {
+        return;
+    }
+    var input = new midi.input();
+
+    input.openPort(portNumber);
+    // Receive SysEx, ignore timing and active sensing
+    input.ignoreTypes(false, true, true);
+    listen(device, input);
+
+    device.input = input;
+    device.key = key;
+
+    // The box's output port has the same name as its input port.  Boxes
+    // that share port names are matched up by position.
+    var portName = input.getPortName(portNumber);
+    var occurrence = findPorts(input, portName).indexOf(portNumber);
+    var controlPort = findPorts(probeOutput, portName)[occurrence];
+    if (controlPort != undefined) {
+        device.control = new midi.output();
+        device.control.openPort(controlPort);
+        // Ask the device where its dials are instead of assuming zero
+        device.control.sendMessage([0x90, dialproto.SNAPSHOT_REQUEST_NOTE, 127]);
+    }
+
+    console.log(key, 'connected', serial ? 'serial number ' + serial : 'without serial number');
+}
+
+function disconnect(key) {
+    var device;
+    Object.keys(devices).forEach(function (id) {
+        if (devices[id].key == key) {
+            device = devices[id];
+        }
+    });
+    if (!device) {
+        return;
+    }
+    device.key = undefined;
+
+    device.input.closePort();
+    device.input = undefined;
+    if (device.control) {
+        device.control.closePort();
+        device.control = undefined;
+    }
+
+    console.log(key, 'disconnected');
+}
+
+serialPorts.forEach(function (path) {
+    var device = devices[path];
+    if (!device) {
+        return;
     }
+    var box = new SerialDialBox(path, protocol);
+    box.on('error', function (error) {
+        console.log(path, error.message);
+    });
+    listen(device, box);
+    device.input = box;
+    box.requestSnapshot();
+    console.log(path, 'connected');
 });
 
+new PortWatcher(portNames)
+    .on('add', connect)
+    .on('remove', disconnect)
+    .start();
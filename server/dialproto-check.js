@@ -0,0 +1,88 @@
+// Runs the test vectors printed by firmware/host/dialcheck -v through
+// this module's decoders, so that dialproto.js is checked against
+// dialproto.h as built for the firmware.  The decoders are set up the
+// way the relays set them up, with nothing but the dial count, so the
+// module's defaults must match the header's configuration:
+//
+//   firmware/host/dialcheck -v | node dialproto-check.js
+//
+// Exits with status 1 if a vector does not decode.
+
+var dialproto = require('./dialproto');
+
+var protocol;
+var vectors = 0;
+var failures = 0;
+
+function check(ok, what, line) {
+    if (!ok) {
+        console.log('FAIL:', what, line);
+        failures++;
+    }
+}
+
+function checkVector(line) {
+    var vector = JSON.parse(line);
+    if (vector.config) {
+        protocol = new dialproto.Protocol({ dialCount: vector.config.dialCount });
+        check(protocol.baseCc == vector.config.baseCc
+              && protocol.encoding == vector.config.encoding,
+              'default BASE_CC and DIAL_ENCODING', line);
+        check(dialproto.SNAPSHOT_REQUEST_NOTE == vector.config.snapshotRequestNote
+              && dialproto.FILTER_STATS_REQUEST_NOTE == vector.config.filterStatsRequestNote,
+              'host command notes', line);
+        var span = vector.config.encoding == dialproto.SIGN_PAIR ? 2 : 1;
+        check(!protocol.decodeDelta(vector.config.baseCc - 1, 1)
+              && !protocol.decodeDelta(vector.config.baseCc + span * vector.config.dialCount, 1),
+              'controllers outside the dial range are ignored', line);
+    } else if (vector.messages) {
+        var sum = 0;
+        var ok = true;
+        vector.messages.forEach(function (message) {
+            ok = ok && protocol.decodeDelta(message[0], message[1]) && protocol.dial == vector.dial;
+            sum += protocol.delta;
+        });
+        check(ok && sum == vector.delta, 'delta', line);
+        check(JSON.stringify(protocol.encodeDelta(vector.dial, vector.delta))
+              == JSON.stringify(vector.messages),
+              'delta encoding', line);
+    } else if (vector.sysex) {
+        check(protocol.isSnapshot(vector.sysex)
+              && dialproto.unpackSysExValues(vector.sysex).join() == vector.values.join(),
+              'snapshot', line);
+        check(dialproto.packSysExValues(dialproto.SYSEX_SNAPSHOT, vector.values).join()
+              == vector.sysex.join(),
+              'snapshot packing', line);
+    } else if (vector.bytes) {
+        var parser = new dialproto.FrameParser();
+        var frames = [];
+        vector.bytes.forEach(function (c) {
+            if (parser.parse(c)) {
+                frames.push([parser.dial, parser.value]);
+            }
+        });
+        check(JSON.stringify(frames) == JSON.stringify(vector.frames)
+              && parser.skipped == vector.skipped,
+              'frame parsing', line);
+    }
+    vectors++;
+}
+
+var input = '';
+process.stdin.setEncoding('utf8');
+process.stdin.on('data', function (chunk) {
+    input += chunk;
+});
+process.stdin.on('end', function () {
+    input.split('\n').forEach(function (line) {
+        if (line.trim()) {
+            checkVector(line);
+        }
+    });
+    if (!vectors) {
+        console.log('FAIL: no test vectors on standard input');
+        process.exit(1);
+    }
+    console.log(vectors, 'vectors,', failures, 'failed');
+    process.exit(failures ? 1 : 0);
+});
@@ -0,0 +1,153 @@
+// Host side of the dial box protocol.  The wire formats are defined in
+// firmware/dialproto.h, and this module decodes them, and encodes them
+// for dial boxes on a serial port (see serialbox.js).  Its defaults are
+// the header's.  "make -C firmware/host check" runs test vectors from
+// the header through this module, see dialproto-check.js.
+
+var TWOS_COMPLEMENT = 0;
+var SIGN_PAIR = 1;
+
+var DIALS_PER_BOX = 8;
+var DIAL_FRAME_BASE = 0x30;
+var DIAL_MAX_STEP = 63;
+
+var SYSEX_MANUFACTURER_ID = 0x7D;
+var SYSEX_SNAPSHOT = 0x01;
+var SYSEX_FILTER_STATS = 0x02;
+var SYSEX_SET_DEADBAND = 0x03;
+
+// options: dialCount, baseCc and encoding, as DIAL_COUNT, BASE_CC and
+// DIAL_ENCODING in dialproto.h
+function Protocol(options) {
+    this.dialCount = options.dialCount || 8;
+    this.baseCc = options.baseCc == undefined ? 20 : options.baseCc;
+    this.encoding = options.encoding || TWOS_COMPLEMENT;
+    var controllers = (this.encoding == SIGN_PAIR ? 2 : 1) * this.dialCount;
+    if (this.baseCc + controllers > 128) {
+        throw new Error('dial controllers ' + this.baseCc + ' to '
+                        + (this.baseCc + controllers - 1) + ' exceed the 7 bit range');
+    }
+    // Result of the last successful decodeDelta call
+    this.dial = 0;
+    this.delta = 0;
+}
+
+// Decode a CC message into this.dial and this.delta.  Returns false if
+// the controller does not belong to a dial.
+Protocol.prototype.decodeDelta = function (controller, value) {
+    var offset = controller - this.baseCc;
+    if (this.encoding == SIGN_PAIR) {
+        if (offset < 0 || offset >= 2 * this.dialCount) {
+            return false;
+        }
+        this.dial = offset >> 1;
+        this.delta = (offset & 1) ? value : -value;
+    } else {
+        if (offset < 0 || offset >= this.dialCount) {
+            return false;
+        }
+        this.dial = offset;
+        this.delta = (value & 0x40) ? value - 0x80 : value;
+    }
+    return true;
+};
+
+// Take a non-zero delta apart into the CC messages that carry it, as
+// [controller, value] pairs, like encodeDialDelta
+Protocol.prototype.encodeDelta = function (dial, delta) {
+    var messages = [];
+    while (delta) {
+        var step = Math.max(-DIAL_MAX_STEP, Math.min(DIAL_MAX_STEP, delta));
+        delta -= step;
+        if (this.encoding == SIGN_PAIR) {
+            messages.push([this.baseCc + 2 * dial + (step > 0 ? 1 : 0), Math.abs(step)]);
+        } else {
+            messages.push([this.baseCc + dial, step & 0x7f]);
+        }
+    }
+    return messages;
+};
+
+// Serial frames from a dial box, byte by byte, like parseDialFrame.
+// parse returns true when a byte completes a frame, which is then in
+// this.dial and this.value.  Bytes that cannot start a frame are
+// skipped and counted in this.skipped.
+function FrameParser() {
+    this.count = 0;
+    this.dial = 0;
+    this.value = 0;
+    this.skipped = 0;
+}
+
+FrameParser.prototype.parse = function (c) {
+    switch (this.count) {
+    case 0:
+        if (c >= DIAL_FRAME_BASE && c < DIAL_FRAME_BASE + DIALS_PER_BOX) {
+            this.dial = c - DIAL_FRAME_BASE;
+            this.count = 1;
+        } else {
+            this.skipped++;
+        }
+        break;
+    case 1:
+        this.value = c << 8;
+        this.count = 2;
+        break;
+    case 2:
+        this.value |= c;
+        this.count = 0;
+        return true;
+    }
+    return false;
+};
+
+function isSysEx(message, type) {
+    return (message[0] == 0xF0)
+        && (message[1] == SYSEX_MANUFACTURER_ID)
+        && (message[2] == type);
+}
+
+// 16 bit values packed as three 7 bit bytes each, see packSysExValue
+function unpackSysExValues(message) {
+    var result = [];
+    for (var i = 3; i + 2 < message.length - 1; i += 3) {
+        result.push((message[i] << 14) | (message[i + 1] << 7) | message[i + 2]);
+    }
+    return result;
+}
+
+// SysEx message of the given type with one 16 bit value per dial, see
+// packSysExValue
+function packSysExValues(type, values) {
+    var message = [0xF0, SYSEX_MANUFACTURER_ID, type];
+    values.forEach(function (value) {
+        message.push((value >> 14) & 0x03, (value >> 7) & 0x7f, value & 0x7f);
+    });
+    message.push(0xF7);
+    return message;
+}
+
+// SysEx command that sets the jitter filter deadband of a dial
+function deadbandMessage(dial, deadband) {
+    return [0xF0, SYSEX_MANUFACTURER_ID, SYSEX_SET_DEADBAND, dial, deadband, 0xF7];
+}
+
+Protocol.prototype.isSnapshot = function (message) {
+    return isSysEx(message, SYSEX_SNAPSHOT);
+};
+
+Protocol.prototype.isFilterStats = function (message) {
+    return isSysEx(message, SYSEX_FILTER_STATS);
+};
+
+exports.Protocol = Protocol;
+exports.FrameParser = FrameParser;
+exports.DIALS_PER_BOX = DIALS_PER_BOX;
+exports.SYSEX_SNAPSHOT = SYSEX_SNAPSHOT;
+exports.TWOS_COMPLEMENT = TWOS_COMPLEMENT;
+exports.SIGN_PAIR = SIGN_PAIR;
+exports.unpackSysExValues = unpackSysExValues;
+exports.packSysExValues = packSysExValues;
+exports.deadbandMessage = deadbandMessage;
+exports.SNAPSHOT_REQUEST_NOTE = 127;
+exports.FILTER_STATS_REQUEST_NOTE = 126;
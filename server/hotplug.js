@@ -0,0 +1,194 @@
+// Hot plug detection for dial boxes.
+//
+// A PortWatcher rescans the MIDI input ports whenever its backend
+// reports a possible change and emits
+//
+//   'add'    (key, name, portNumber, serial)  a watched port appeared
+//   'remove' (key, name)                      a watched port went away
+//
+// A port is watched if its name is one of the watched names, or, as
+// ALSA names ports, starts with one of them followed by a colon.
+//
+// key identifies the box behind a port.  If its USB serial number can
+// be found, the key is the watched name plus the serial number, e.g.
+// "SGI Dial Box@8543A2F1", and stays the same however boxes are
+// replugged.  Otherwise it is the name plus the port's occurrence among
+// unidentified ports of that name, e.g. "SGI Dial Box#1".  Occurrences
+// shift when one of several such boxes is unplugged, so whenever the
+// set of those ports changes, all of them are removed and added again.
+//
+// On Linux the backend watches /dev/snd with inotify, so a replugged
+// box is picked up as soon as ALSA creates its device node; elsewhere
+// it polls.  The backend, the port enumeration and the serial number
+// lookup can be replaced, e.g. by mocks.
+
+var EventEmitter = require('events').EventEmitter;
+var fs = require('fs');
+var util = require('util');
+
+function pollBackend(interval) {
+    var timer;
+    return {
+        start: function (onChange) {
+            timer = setInterval(onChange, interval);
+        },
+        stop: function () {
+            clearInterval(timer);
+        }
+    };
+}
+
+// Registering the sequencer port can lag behind the device node by an
+// unknown amount, so after a change in the directory, look again a few
+// times, and back that up with a slow poll.
+var RESCAN_DELAYS = [0, 20, 100, 250, 500, 1000, 2000];
+
+function inotifyBackend(directory, backstopInterval) {
+    var watcher;
+    var backstop;
+    var rescans = [];
+    return {
+        start: function (onChange) {
+            watcher = fs.watch(directory, function () {
+                rescans.forEach(clearTimeout);
+                rescans = RESCAN_DELAYS.map(function (delay) {
+                    return setTimeout(onChange, delay);
+                });
+            });
+            backstop = setInterval(onChange, backstopInterval || 5000);
+        },
+        stop: function () {
+            watcher.close();
+            rescans.forEach(clearTimeout);
+            clearInterval(backstop);
+        }
+    };
+}
+
+function defaultBackend() {
+    if (fs.existsSync('/dev/snd')) {
+        return inotifyBackend('/dev/snd');
+    }
+    return pollBackend(250);
+}
+
+var probe = undefined;
+
+function enumerateInputs() {
+    if (!probe) {
+        probe = new (require('midi').input)();
+    }
+    var names = [];
+    for (var i = 0; i < probe.getPortCount(); i++) {
+        names.push(probe.getPortName(i));
+    }
+    return names;
+}
+
+// RtMidi's ALSA port names end in the sequencer client and port
+// numbers.  The kernel client of sound card N is numbered 16 + 4 * N,
+// and the card's sysfs device is the USB interface, whose parent holds
+// the serial number.
+function alsaSerial(portName) {
+    var match = / (\d+):\d+$/.exec(portName);
+    if (!match || parseInt(match[1]) < 16) {
+        return undefined;
+    }
+    var card = (parseInt(match[1]) - 16) >> 2;
+    try {
+        return fs.readFileSync('/sys/class/sound/card' + card + '/device/../serial', 'latin1').trim() || undefined;
+    } catch (e) {
+        return undefined;
+    }
+}
+
+// options.backend: object with start(onChange) and stop()
+// options.enumerate: function returning the current input port names
+// options.identify: function returning the USB serial number of the
+//                   device behind a port name, or undefined
+function PortWatcher(names, options) {
+    EventEmitter.call(this);
+    options = options || {};
+    this.names = names;
+    this.backend = options.backend || defaultBackend();
+    this.enumerate = options.enumerate || enumerateInputs;
+    this.identify = options.identify || alsaSerial;
+    this.ports = {};
+    this.layouts = {};
+}
+
+util.inherits(PortWatcher, EventEmitter);
+
+PortWatcher.prototype.start = function () {
+    var watcher = this;
+    this.backend.start(function () {
+        watcher.scan();
+    });
+    this.scan();
+    return this;
+};
+
+PortWatcher.prototype.stop = function () {
+    this.backend.stop();
+};
+
+PortWatcher.prototype.watchedName = function (portName) {
+    for (var i = 0; i < this.names.length; i++) {
+        var name = this.names[i];
+        if (portName == name || portName.indexOf(name + ':') == 0) {
+            return name;
+        }
+    }
+    return undefined;
+};
+
+PortWatcher.prototype.scan = function () {
+    var watcher = this;
+    var current = {};
+    var unidentified = {};
+
+    this.enumerate().forEach(function (portName, portNumber) {
+        var name = watcher.watchedName(portName);
+        if (name == undefined) {
+            return;
+        }
+        var serial = watcher.identify(portName);
+        var key;
+        if (serial) {
+            key = name + '@' + serial;
+        } else {
+            unidentified[name] = (unidentified[name] || []).concat(portNumber);
+            key = name + '#' + unidentified[name].length;
+        }
+        current[key] = { name: name, portNumber: portNumber, serial: serial };
+    });
+
+    var layouts = {};
+    this.names.forEach(function (name) {
+        layouts[name] = (unidentified[name] || []).join(',');
+    });
+
+    // A port that moved to another number is reopened, too
+    Object.keys(this.ports).forEach(function (key) {
+        var port = watcher.ports[key];
+        if (!current[key]
+            || current[key].portNumber != port.portNumber
+            || (!port.serial && layouts[port.name] != watcher.layouts[port.name])) {
+            delete watcher.ports[key];
+            watcher.emit('remove', key, port.name);
+        }
+    });
+    this.layouts = layouts;
+
+    Object.keys(current).forEach(function (key) {
+        if (!watcher.ports[key]) {
+            var port = watcher.ports[key] = current[key];
+            watcher.emit('add', key, port.name, port.portNumber, port.serial);
+        }
+    });
+};
+
+exports.PortWatcher = PortWatcher;
+exports.pollBackend = pollBackend;
+exports.inotifyBackend = inotifyBackend;
+exports.alsaSerial = alsaSerial;
@@ -0,0 +1,35 @@
+// Output thread for the dial box relays: takes [status, data1, data2]
+// records from an SpscQueue and sends them to a MIDI output port, so a
+// slow destination never holds up the input callback.
+
+var workerThreads = require('worker_threads');
+var midi = require('midi');
+var SpscQueue = require('./spsc').SpscQueue;
+
+var queue = new SpscQueue(workerThreads.workerData.queue);
+var portName = workerThreads.workerData.portName;
+
+var output = new midi.output();
+var portNumber = undefined;
+
+for (var i = 0; i < output.getPortCount(); i++) {
+    if (output.getPortName(i) == portName) {
+        portNumber = i;
+        break;
+    }
+}
+
+if (portNumber == undefined) {
+    throw new Error('could not find output port ' + portName);
+}
+
+output.openPort(portNumber);
+
+var record = new Int32Array(3);
+
+for (;;) {
+    while (queue.pop(record)) {
+        output.sendMessage([record[0], record[1], record[2]]);
+    }
+    queue.wait();
+}
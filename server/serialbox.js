@@ -0,0 +1,93 @@
+// A dial box on a serial port, read without the USB converter.
+//
+// A SerialDialBox puts the tty into raw 9600 8N1 mode, initializes the
+// box and turns its frames into the CC messages the converter firmware
+// sends for the same movement.  It emits them like a midi.input does,
+//
+//   'message' (deltaTime, message)
+//
+// so that the relays treat boxes on either path alike, and 'error'
+// (error) when the port fails.  As in the firmware, each dial starts
+// at position zero; requestSnapshot emits the snapshot SysEx message
+// the firmware would send.  The firmware's jitter filter is not
+// applied.
+
+var EventEmitter = require('events').EventEmitter;
+var child_process = require('child_process');
+var fs = require('fs');
+var tty = require('tty');
+var util = require('util');
+var dialproto = require('./dialproto');
+
+var DIAL_INITIALIZE = [0x20, 0x50, 0x00, 0xFF];
+
+function SerialDialBox(path, protocol) {
+    EventEmitter.call(this);
+    this.path = path;
+    this.protocol = protocol;
+    this.parser = new dialproto.FrameParser();
+    this.positions = [];
+    for (var i = 0; i < dialproto.DIALS_PER_BOX; i++) {
+        this.positions.push(0);
+    }
+    this.lastMessage = undefined;
+
+    child_process.execFileSync('stty', [process.platform == 'darwin' ? '-f' : '-F', path,
+                                        '9600', 'raw', '-echo', 'cs8', '-cstopb', '-parenb',
+                                        'clocal', 'cread']);
+    // Push received bytes to the tty layer right away where the driver
+    // supports it
+    try {
+        child_process.execFileSync('setserial', [path, 'low_latency'], { stdio: 'ignore' });
+    } catch (e) {
+        // No setserial, or not a serial_core port, e.g. a USB adapter
+    }
+
+    this.fd = fs.openSync(path, fs.constants.O_RDWR | fs.constants.O_NOCTTY);
+    fs.writeSync(this.fd, Buffer.from(DIAL_INITIALIZE));
+
+    var box = this;
+    this.stream = new tty.ReadStream(this.fd);
+    this.stream.on('data', function (data) {
+        box.receive(data);
+    });
+    this.stream.on('error', function (error) {
+        box.emit('error', error);
+    });
+}
+
+util.inherits(SerialDialBox, EventEmitter);
+
+SerialDialBox.prototype.send = function (message) {
+    var now = process.hrtime();
+    var deltaTime = this.lastMessage
+        ? (now[0] - this.lastMessage[0]) + (now[1] - this.lastMessage[1]) / 1e9
+        : 0;
+    this.lastMessage = now;
+    this.emit('message', deltaTime, message);
+};
+
+SerialDialBox.prototype.receive = function (data) {
+    for (var i = 0; i < data.length; i++) {
+        if (this.parser.parse(data[i])) {
+            var dial = this.parser.dial;
+            // Positions wrap around like the firmware's 16 bit delta
+            var delta = ((this.parser.value - this.positions[dial] + 0x8000) & 0xffff) - 0x8000;
+            this.positions[dial] = this.parser.value;
+            var box = this;
+            this.protocol.encodeDelta(dial, delta).forEach(function (cc) {
+                box.send([0xB0, cc[0], cc[1]]);
+            });
+        }
+    }
+};
+
+SerialDialBox.prototype.requestSnapshot = function () {
+    this.send(dialproto.packSysExValues(dialproto.SYSEX_SNAPSHOT, this.positions));
+};
+
+SerialDialBox.prototype.close = function () {
+    this.stream.destroy();
+};
+
+exports.SerialDialBox = SerialDialBox;
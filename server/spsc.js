@@ -0,0 +1,82 @@
+// Bounded single producer, single consumer queue of fixed size integer
+// records in a SharedArrayBuffer, for handing events from one thread to
+// another without locks.  A full queue drops the new record and counts
+// it as an overflow instead of blocking the producer.
+//
+// head and tail are free running counters; only the producer writes
+// head and only the consumer writes tail.
+
+var HEAD = 0;
+var TAIL = 1;
+var OVERFLOWS = 2;
+var CAPACITY = 3;
+var RECORD_SIZE = 4;
+var HEADER_INTS = 8;
+
+function SpscQueue(buffer) {
+    this.buffer = buffer;
+    this.header = new Int32Array(buffer, 0, HEADER_INTS);
+    this.capacity = this.header[CAPACITY];
+    this.recordSize = this.header[RECORD_SIZE];
+    this.mask = this.capacity - 1;
+    this.records = new Int32Array(buffer, HEADER_INTS * 4, this.capacity * this.recordSize);
+}
+
+// Allocate a queue holding at least capacity records of recordSize ints
+SpscQueue.create = function (capacity, recordSize) {
+    var size = 1;
+    while (size < capacity) {
+        size <<= 1;
+    }
+    var buffer = new SharedArrayBuffer((HEADER_INTS + size * recordSize) * 4);
+    var header = new Int32Array(buffer, 0, HEADER_INTS);
+    header[CAPACITY] = size;
+    header[RECORD_SIZE] = recordSize;
+    return new SpscQueue(buffer);
+};
+
+// Producer side.  Returns false if the record was dropped.
+SpscQueue.prototype.push = function (record) {
+    var head = this.header[HEAD];
+    var tail = Atomics.load(this.header, TAIL);
+    if (((head - tail) | 0) >= this.capacity) {
+        Atomics.add(this.header, OVERFLOWS, 1);
+        return false;
+    }
+    var offset = (head & this.mask) * this.recordSize;
+    for (var i = 0; i < this.recordSize; i++) {
+        this.records[offset + i] = record[i];
+    }
+    Atomics.store(this.header, HEAD, (head + 1) | 0);
+    Atomics.notify(this.header, HEAD);
+    return true;
+};
+
+// Consumer side.  Copies the oldest record into record, returns false
+// if the queue is empty.
+SpscQueue.prototype.pop = function (record) {
+    var tail = this.header[TAIL];
+    if (Atomics.load(this.header, HEAD) == tail) {
+        return false;
+    }
+    var offset = (tail & this.mask) * this.recordSize;
+    for (var i = 0; i < this.recordSize; i++) {
+        record[i] = this.records[offset + i];
+    }
+    Atomics.store(this.header, TAIL, (tail + 1) | 0);
+    return true;
+};
+
+// Consumer side.  Blocks the calling thread until the queue is not empty.
+SpscQueue.prototype.wait = function () {
+    var head = Atomics.load(this.header, HEAD);
+    if (head == this.header[TAIL]) {
+        Atomics.wait(this.header, HEAD, head);
+    }
+};
+
+SpscQueue.prototype.overflows = function () {
+    return Atomics.load(this.header, OVERFLOWS);
+};
+
+exports.SpscQueue = SpscQueue;
@@ -0,0 +1,24 @@
+// Print a trace file written by trace.js, one event per line:
+// time since the first event (ms), dial, controller, raw value, output
+
+var fs = require('fs');
+var trace = require('./trace');
+
+if (process.argv.length != 3) {
+    console.error('usage: node trace-decode.js TRACE-FILE');
+    process.exit(1);
+}
+
+var decoded = trace.decode(fs.readFileSync(process.argv[2]));
+var events = decoded.events;
+
+if (events.length) {
+    console.log('# started', new Date(decoded.origin + events[0].time).toISOString());
+}
+
+var lines = [];
+events.forEach(function (event) {
+    lines.push([(event.time - events[0].time).toFixed(3),
+                event.dial, event.controller, event.raw, event.output].join('\t'));
+});
+process.stdout.write(lines.join('\n') + (lines.length ? '\n' : ''));
@@ -0,0 +1,123 @@
+// Low overhead event tracing for the dial box relays.
+//
+// Events are recorded into preallocated typed arrays used as a ring,
+// so recording allocates nothing and never touches stdout.  The ring
+// is written to a file on SIGUSR2, or optionally when "dump" is typed
+// on stdin, and decoded offline with trace-decode.js.
+//
+// File format, little endian: "DBTR", u32 version, u32 record count,
+// f64 time origin (ms since the epoch), then per record f64 time (ms
+// since the origin), u8 dial, u8 controller, u8 raw value, u8 unused,
+// i32 output value.
+
+var fs = require('fs');
+var performance = require('perf_hooks').performance;
+
+var MAGIC = 'DBTR';
+var VERSION = 1;
+var HEADER_SIZE = 20;
+var RECORD_SIZE = 16;
+
+function Trace(capacity) {
+    // Round up to a power of two so the ring index is a mask
+    var size = 1;
+    while (size < capacity) {
+        size <<= 1;
+    }
+    this.mask = size - 1;
+    this.times = new Float64Array(size);
+    this.dials = new Uint8Array(size);
+    this.controllers = new Uint8Array(size);
+    this.raws = new Uint8Array(size);
+    this.outputs = new Int32Array(size);
+    this.count = 0;
+}
+
+Trace.prototype.record = function (dial, controller, raw, output) {
+    var i = this.count & this.mask;
+    this.times[i] = performance.now();
+    this.dials[i] = dial;
+    this.controllers[i] = controller;
+    this.raws[i] = raw;
+    this.outputs[i] = output;
+    this.count++;
+};
+
+Trace.prototype.dump = function (filename) {
+    var size = this.mask + 1;
+    var records = Math.min(this.count, size);
+    var first = this.count - records;
+    var buffer = Buffer.alloc(HEADER_SIZE + records * RECORD_SIZE);
+
+    buffer.write(MAGIC, 0, 'latin1');
+    buffer.writeUInt32LE(VERSION, 4);
+    buffer.writeUInt32LE(records, 8);
+    buffer.writeDoubleLE(performance.timeOrigin, 12);
+
+    for (var n = 0; n < records; n++) {
+        var i = (first + n) & this.mask;
+        var offset = HEADER_SIZE + n * RECORD_SIZE;
+        buffer.writeDoubleLE(this.times[i], offset);
+        buffer.writeUInt8(this.dials[i], offset + 8);
+        buffer.writeUInt8(this.controllers[i], offset + 9);
+        buffer.writeUInt8(this.raws[i], offset + 10);
+        buffer.writeInt32LE(this.outputs[i], offset + 12);
+    }
+
+    fs.writeFileSync(filename, buffer);
+    return records;
+};
+
+// Dump to filename on SIGUSR2 or on a "dump" line on stdin
+// options.stdin: also dump when "dump" is read from stdin.  Off by
+// default, as a relay started in the background from a terminal would
+// be stopped by SIGTTIN when reading it.
+Trace.prototype.install = function (filename, options) {
+    var trace = this;
+    options = options || {};
+
+    function dump() {
+        var records = trace.dump(filename);
+        console.error('trace: wrote', records, 'of', trace.count, 'events to', filename);
+    }
+
+    process.on('SIGUSR2', dump);
+
+    if (options.stdin) {
+        process.stdin.setEncoding('latin1');
+        process.stdin.on('data', function (data) {
+            if (data.split(/\r?\n/).indexOf('dump') != -1) {
+                dump();
+            }
+        });
+    }
+};
+
+function decode(buffer) {
+    if (buffer.toString('latin1', 0, 4) != MAGIC) {
+        throw new Error('not a dial box trace file');
+    }
+    if (buffer.readUInt32LE(4) != VERSION) {
+        throw new Error('unsupported trace version ' + buffer.readUInt32LE(4));
+    }
+
+    var records = buffer.readUInt32LE(8);
+    var result = {
+        origin: buffer.readDoubleLE(12),
+        events: []
+    };
+    for (var n = 0; n < records; n++) {
+        var offset = HEADER_SIZE + n * RECORD_SIZE;
+        result.events.push({
+            time: buffer.readDoubleLE(offset),
+            dial: buffer.readUInt8(offset + 8),
+            controller: buffer.readUInt8(offset + 9),
+            raw: buffer.readUInt8(offset + 10),
+            output: buffer.readInt32LE(offset + 12)
+        });
+    }
+    return result;
+}
+
+exports.Trace = Trace;
+exports.decode = decode;